@@ -0,0 +1,91 @@
+// json_arena_bench: compare heap allocations and time per request of the
+// plain nlohmann::json with the arena-backed json used by the plugin, for a
+// typical request/response round trip: parse the request, build a response
+// with a list of items and serialize it.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "arena.hpp"
+#include "ipc_json.hpp"
+
+#define REQUESTS 20000
+#define ITEMS 50
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+static const char* request =
+    "{\"command\":\"get-playlist-contents\",\"request_id\":42,"
+    "\"args\":{\"plt\":0,\"start\":0,\"count\":50,"
+    "\"format\":\"%artist% - %title%\"}}";
+
+template <typename J>
+size_t round_trip(std::string& out) {
+    J message = J::parse(request);
+    J items = J::array();
+    int count = message["args"]["count"].template get<int>();
+    for (int i = 0; i < count; i++) {
+        items.push_back(J{
+            {"title", "Some Artist - Some Title"},
+            {"selected", false},
+            {"idx", i},
+        });
+    }
+    J response = {
+        {"request_id", message["request_id"]},
+        {"status", 0},
+        {"items", std::move(items)},
+    };
+    out.clear();
+    nlohmann::detail::serializer<J> s(
+        nlohmann::detail::output_adapter<char>(out), ' '
+    );
+    s.dump(response, false, false, 0);
+    return out.size();
+}
+
+template <typename J>
+void run(const char* name, bool arena) {
+    std::string out;
+    out.reserve(8192);
+    size_t bytes = 0;
+    size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < REQUESTS; i++) {
+        if (arena) {
+            ddb_ipc::ArenaScope scope;
+            bytes += round_trip<J>(out);
+        } else {
+            bytes += round_trip<J>(out);
+        }
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf(
+        "%-14s %8.1f allocations/request %8.2f us/request (%zu bytes)\n",
+        name,
+        (double)(allocations - before) / REQUESTS,
+        elapsed.count() / REQUESTS,
+        bytes / REQUESTS
+    );
+}
+
+int main() {
+    run<nlohmann::json>("nlohmann::json", false);
+    run<json>("arena json", true);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#ifndef DDB_IPC_ARENA_HPP
+#define DDB_IPC_ARENA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#ifndef DDB_IPC_ARENA_BLOCK_SIZE
+#define DDB_IPC_ARENA_BLOCK_SIZE (64 * 1024)
+#endif
+// Count the live allocations of each arena, and abort if any outlives its
+// ArenaScope or is freed after it
+#ifndef DDB_IPC_ARENA_CHECKS
+#define DDB_IPC_ARENA_CHECKS 0
+#endif
+
+namespace ddb_ipc {
+
+// A monotonic arena: allocations bump a pointer through a list of blocks,
+// deallocation does nothing, and reset() releases everything at once while
+// keeping the first block for reuse.
+class Arena {
+  public:
+    bool active = false;
+    // bumped by reset()
+    uint64_t generation = 0;
+#if DDB_IPC_ARENA_CHECKS
+    // allocated and not yet deallocated, possibly by another thread
+    std::atomic<size_t> live{0};
+#endif
+
+    void* allocate(size_t size, size_t align);
+    // Bytes in the blocks held
+    size_t size() const;
+    void reset();
+
+  private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    // bytes used of the last block
+    size_t used = 0;
+};
+
+// Allocate from the calling thread's arena if it is active, otherwise from
+// the heap. The memory is preceded by a header naming the arena it came from,
+// as the allocators cannot carry it: nlohmann::json default-constructs them.
+// align must not exceed alignof(std::max_align_t).
+void* arena_allocate(size_t size, size_t align);
+// Free p if it came from the heap; memory of an arena, whichever thread's it
+// is, is reclaimed when that arena is reset
+void arena_deallocate(void* p);
+
+// Bytes held by the calling thread's arena
+size_t arena_size();
+
+// A stateless allocator over the calling thread's arena, as nlohmann::json
+// default-constructs its allocators; each allocation records its own arena.
+template <typename T>
+class ArenaAllocator {
+  public:
+    typedef T value_type;
+
+    ArenaAllocator() noexcept = default;
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= alignof(std::max_align_t));
+        return static_cast<T*>(arena_allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t n) { arena_deallocate(p); }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&) {
+    return true;
+}
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&) {
+    return false;
+}
+
+// Serve the calling thread's allocations from its arena for the lifetime of
+// the scope, then reset the arena. Nothing allocated in the scope may outlive
+// it; see HeapScope.
+class ArenaScope {
+  public:
+    ArenaScope();
+    ~ArenaScope();
+};
+
+// Suspend the calling thread's arena, for objects created in an ArenaScope
+// that must outlive it
+class HeapScope {
+  public:
+    HeapScope();
+    ~HeapScope();
+
+  private:
+    bool was_active;
+};
+
+}  // namespace ddb_ipc
+
+#endif
@@ -1,10 +1,10 @@
 #ifndef DDB_IPC_ARGUMENT_HPP
 #define DDB_IPC_ARGUMENT_HPP
 
-#include <nlohmann/json.hpp>
-using json = nlohmann::json;
 #include <optional>
 
+#include "ipc_json.hpp"
+
 namespace ddb_ipc {
 
 class Argument {};
@@ -0,0 +1,31 @@
+#ifndef DDB_IPC_CAPTURE_HPP
+#define DDB_IPC_CAPTURE_HPP
+
+#include <string_view>
+
+namespace ddb_ipc {
+
+// Opt-in recording of client traffic, to be played back with ddb_ipc_replay.
+// A capture is a text file with one record per line,
+//     <microseconds> <connection> <kind> <message>
+// where kind is + (connected), - (disconnected), < (sent by the client) or
+// > (sent to the client), and the message is empty for + and -. Connections
+// are numbered in the order they were accepted.
+
+// Start, stop, or switch capture files according to the capture_path setting
+void update_capture();
+void stop_capture();
+
+void capture_connected(int socket);
+void capture_disconnected(int socket);
+void capture_message(int socket, char kind, std::string_view message);
+// Record a message that is sent in parts, as streamed responses are. Nothing
+// else may be captured between its first and last part, except that the
+// next record ends a message whose sending failed before its last part.
+void capture_message_part(
+    int socket, char kind, std::string_view part, bool first, bool last
+);
+
+}  // namespace ddb_ipc
+
+#endif
@@ -1,12 +1,11 @@
 #ifndef DDB_IPC_COMMANDS_HPP
 #define DDB_IPC_COMMANDS_HPP
 
-#include <nlohmann/json.hpp>
-using json = nlohmann::json;
-
 #include <optional>
+#include <string>
 
 #include "argument.hpp"
+#include "ipc_json.hpp"
 
 typedef std::optional<int> request_id;
 
@@ -21,7 +20,26 @@ namespace ddb_ipc {
 
 typedef json (*ipc_command)(request_id, json);
 
+// The lane a command is queued in until it is dispatched. Waiting requests
+// are dispatched highest priority first, across connections; see
+// ddb_ipc.cpp for the order within a connection.
+enum CommandPriority {
+    // transport controls and the like, which users wait on
+    DDB_IPC_PRIORITY_INTERACTIVE,
+    DDB_IPC_PRIORITY_NORMAL,
+    // read-only commands whose responses may be large or slow to build
+    DDB_IPC_PRIORITY_BULK,
+    DDB_IPC_PRIORITY_CLASSES,
+};
+
+struct CommandSpec {
+    ipc_command call;
+    CommandPriority priority;
+};
+
 json call_command(std::string command, request_id id, json args);
+// DDB_IPC_PRIORITY_NORMAL for unknown commands, which are answered quickly
+CommandPriority command_priority(const std::string& command);
 
 }  // namespace ddb_ipc
 
@@ -0,0 +1,20 @@
+#ifndef DDB_IPC_COVER_ART_HPP
+#define DDB_IPC_COVER_ART_HPP
+
+#include <deadbeef/deadbeef.h>
+
+#include <optional>
+#include <string>
+
+namespace ddb_ipc {
+
+// Look up the cover art of the tracks that will play next so that it is
+// cached by the time a client requests it.
+void prefetch_cover_art();
+
+std::optional<std::string> cached_cover_art(DB_playItem_t* track);
+void cache_cover_art(DB_playItem_t* track, std::string filename);
+
+}  // namespace ddb_ipc
+
+#endif
@@ -7,10 +7,37 @@
 #define DDB_IPC_PROJECT_DESC "Provides socket-based IPC using JSON messages."
 #define DDB_IPC_PROJECT_URL "https://github.com/rsekman/ddb-ipc"
 #define DDB_IPC_DEFAULT_SOCKET "/tmp/ddb_socket"
-#define DDB_IPC_POLL_FREQ 1000      // Socket polling frequency in ms
-#define DDB_IPC_WRITE_TIMEOUT 5000  // Timeout for sending messages
+#define DDB_IPC_WRITE_TIMEOUT 5000  // Milliseconds for a client to read
 #define DDB_IPC_MAX_PACKET_LENGTH 4096
+#define DDB_IPC_MAX_RETAINED_BUFFER (1 << 20)  // Largest kept output buffer
+#define DDB_IPC_MAX_OUTPUT_BACKLOG (32 << 20)  // Unread bytes per client
+#define DDB_IPC_MAX_ARENA_BACKLOG (4 << 20)  // Arena bytes to stop reading at
+#define DDB_IPC_STREAM_CHUNK (64 << 10)  // Bytes per write of a stream
 #define DDB_IPC_MAX_CONNECTIONS 15
+#define DDB_IPC_DEFAULT_BACKLOG 64
+#define DDB_IPC_DEFAULT_IDLE_TIMEOUT 0  // Seconds, 0 to keep idle clients
+#define DDB_IPC_DEFAULT_HEARTBEAT 0     // Seconds, 0 to never ping clients
+#define DDB_IPC_TIMER_TICK_MS 100       // Resolution of connection timers
+#define DDB_IPC_LISTEN_FDS_START 3  // First descriptor passed by a supervisor
+#define DDB_IPC_INTERRUPT_CHECK_ITEMS 64  // Items between deadline checks
+#define DDB_IPC_DEFAULT_LOCK_CHUNK_ITEMS 1000  // Items per pl_lock hold
+#define DDB_IPC_DEFAULT_LOCK_CHUNK_US 2000     // Microseconds per pl_lock hold
+#define DDB_IPC_FORMAT_BATCH 4096  // Items formatted between sends
+#define DDB_IPC_PARALLEL_FORMAT_MIN 256  // Smallest batch worth spreading
+#define DDB_IPC_MAX_FORMAT_THREADS 16
+#define DDB_IPC_DEFAULT_PREFETCH 1        // Tracks to prefetch cover art for
+#define DDB_IPC_COVER_ART_CACHE_SIZE 16
+#define DDB_IPC_TRACE_SPANS 4096  // Spans kept for dump-trace
+#define DDB_IPC_EVENT_LOG_SIZE 256  // Events kept for resume
+#define DDB_IPC_RESPONSE_CACHE_SIZE 64
+#define DDB_IPC_RESPONSE_CACHE_EVENTS 128  // Event ids with a generation
+#define DDB_IPC_VIS_MAX_CHANNELS 8
+#define DDB_IPC_VIS_MAX_BINS 1024  // Spectrum bins kept per channel
+#define DDB_IPC_VIS_MAX_FPS 60
+#define DDB_IPC_VIS_DEFAULT_FPS 30
+#define DDB_IPC_VIS_MAX_BANDS 64
+#define DDB_IPC_VIS_DEFAULT_BANDS 16
+#define DDB_IPC_VIS_SPECTRUM_RANGE_DB 60
 #define DDB_IPC_LICENSE_TEXT                                                 \
     "Copyright 2021 Robin Ekman\n"                                           \
     "\n"                                                                     \
@@ -39,16 +66,45 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 
-#include <nlohmann/json.hpp>
+#include <functional>
+#include <string>
 
-using json = nlohmann::json;
+#include "ipc_json.hpp"
+#include "response.hpp"
+#include "timer_wheel.hpp"
 
 namespace ddb_ipc {
 
 extern DB_functions_t* ddb_api;
 extern ddb_artwork_plugin_t* ddb_artwork;
 
-void send_response(json msg, int socket);
+// If fd is a valid descriptor, it is passed to the client with SCM_RIGHTS
+// along with the first bytes of the message.
+void send_response(const json& msg, int socket, int fd = -1);
+// The buffer responses to socket are serialized into; IPC thread only
+std::string& output_buffer(int socket);
+// Write bytes to socket without blocking; what it does not accept now is kept
+// and written once it is writable. A client that leaves more than
+// DDB_IPC_MAX_OUTPUT_BACKLOG bytes unread, or reads nothing for the write
+// timeout, is disconnected. On failure the connection is closed and false
+// returned. IPC thread only.
+bool send_bytes(
+    int socket, const char* bytes, size_t len, request_id id, int fd = -1
+);
+// Whether some of what was sent to socket has yet to be written; IPC thread
+// only
+bool output_pending(int socket);
+// Events are numbered and logged for clients that reconnect and resume. May
+// be called from any thread; the event is sent from the IPC thread.
+void broadcast(json message);
+
+// Run f on the IPC thread once the response being handled has been sent
+void defer(std::function<void()> f);
+// Run f on the IPC thread as soon as possible; may be called from any thread
+void post(std::function<void()> f);
+
+// Timers run by the IPC thread; IPC thread only
+extern TimerWheel timers;
 
 std::shared_ptr<spdlog::logger> get_logger();
 
@@ -0,0 +1,18 @@
+#ifndef DDB_IPC_EVENT_LOG_HPP
+#define DDB_IPC_EVENT_LOG_HPP
+
+#include "commands.hpp"
+#include "ipc_json.hpp"
+
+namespace ddb_ipc {
+
+// Give a broadcast event the next sequence number, under the key seq, and
+// keep a copy in the log of recent events. Callers must serialize calls with
+// the sending of the events so that clients see them in order.
+void log_event(json& event);
+
+json command_resume(request_id id, json args);
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef DDB_IPC_FORMAT_POOL_HPP
+#define DDB_IPC_FORMAT_POOL_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <deadbeef/deadbeef.h>
+
+namespace ddb_ipc {
+
+// Evaluate the compiled title format code for each of n items into the
+// corresponding result, spreading large batches over a pool of threads with
+// a buffer each. The pool has ddb_ipc.format_threads threads counting the
+// caller (default: one per core, up to DDB_IPC_MAX_FORMAT_THREADS) and is
+// started on first use. The items must be referenced; pl_lock need not be
+// held. IPC thread only.
+void format_items(
+    char* code,
+    DB_playItem_t* const* items,
+    size_t n,
+    int iter,
+    std::string* results
+);
+// Join the threads of the pool
+void stop_format_pool();
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef DDB_IPC_FORMAT_SUBSCRIPTION_HPP
+#define DDB_IPC_FORMAT_SUBSCRIPTION_HPP
+
+#include "commands.hpp"
+#include "ipc_json.hpp"
+
+namespace ddb_ipc {
+
+json command_subscribe_format(request_id id, json args);
+json command_unsubscribe_format(request_id id, json args);
+
+// Re-evaluate the subscribed formats and send those whose output changed;
+// may be called from any thread
+void on_format_inputs_changed();
+void drop_format_subscriptions(int socket);
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef DDB_IPC_JSON_HPP
+#define DDB_IPC_JSON_HPP
+
+#include <cstdint>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+
+// Unless built with DDB_IPC_ARENA_JSON=0, the JSON documents of requests and
+// responses are allocated from an arena that is reset after each request.
+#ifndef DDB_IPC_ARENA_JSON
+#define DDB_IPC_ARENA_JSON 1
+#endif
+
+#if DDB_IPC_ARENA_JSON
+using json = nlohmann::basic_json<
+    std::map,
+    std::vector,
+    std::string,
+    bool,
+    std::int64_t,
+    std::uint64_t,
+    double,
+    ddb_ipc::ArenaAllocator>;
+#else
+using json = nlohmann::json;
+#endif
+
+// NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE and its _WITH_DEFAULT variant only
+// support nlohmann::json before nlohmann-json 3.11.3; these support our json
+#define DDB_IPC_DEFINE_TYPE(Type, ...)                                    \
+    inline void to_json(json& nlohmann_json_j, const Type& nlohmann_json_t) { \
+        NLOHMANN_JSON_EXPAND(                                             \
+            NLOHMANN_JSON_PASTE(NLOHMANN_JSON_TO, __VA_ARGS__)            \
+        )                                                                 \
+    }                                                                     \
+    inline void from_json(                                                \
+        const json& nlohmann_json_j, Type& nlohmann_json_t                \
+    ) {                                                                   \
+        NLOHMANN_JSON_EXPAND(                                             \
+            NLOHMANN_JSON_PASTE(NLOHMANN_JSON_FROM, __VA_ARGS__)          \
+        )                                                                 \
+    }
+
+#define DDB_IPC_DEFINE_TYPE_WITH_DEFAULT(Type, ...)                       \
+    inline void to_json(json& nlohmann_json_j, const Type& nlohmann_json_t) { \
+        NLOHMANN_JSON_EXPAND(                                             \
+            NLOHMANN_JSON_PASTE(NLOHMANN_JSON_TO, __VA_ARGS__)            \
+        )                                                                 \
+    }                                                                     \
+    inline void from_json(                                                \
+        const json& nlohmann_json_j, Type& nlohmann_json_t                \
+    ) {                                                                   \
+        Type nlohmann_json_default_obj;                                   \
+        NLOHMANN_JSON_EXPAND(NLOHMANN_JSON_PASTE(                         \
+            NLOHMANN_JSON_FROM_WITH_DEFAULT, __VA_ARGS__                  \
+        ))                                                                \
+    }
+
+#endif
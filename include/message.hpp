@@ -1,12 +1,11 @@
 #ifndef DDB_IPC_MESSAGE_HPP
 #define DDB_IPC_MESSAGE_HPP
 
-#include <nlohmann/json.hpp>
 #include <string>
-using json = nlohmann::json;
 #include <optional>
 
 #include "argument.hpp"
+#include "ipc_json.hpp"
 
 namespace ddb_ipc {
 
@@ -16,9 +15,15 @@ class Message {
     request_id id;
     std::string command;
     json args;
-    Message() : id({}), command(""), args({}) {};
-    Message(request_id _id, std::string _command, json _args) :
-        id(_id), command(_command), args(_args) {};
+    std::optional<int> deadline_ms;
+    Message() : id({}), command(""), args({}), deadline_ms({}) {};
+    Message(
+        request_id _id,
+        std::string _command,
+        json _args,
+        std::optional<int> _deadline_ms = {}
+    ) :
+        id(_id), command(_command), args(_args), deadline_ms(_deadline_ms) {};
 };
 void from_json(const json &j, Message &m);
 
@@ -0,0 +1,44 @@
+#ifndef DDB_IPC_METRICS_HPP
+#define DDB_IPC_METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "commands.hpp"
+#include "ipc_json.hpp"
+
+#define DDB_IPC_LATENCY_BUCKETS 128
+
+namespace ddb_ipc {
+
+// A histogram of durations in buckets a quarter of a power of two wide, so
+// that percentiles are reported within 19% of the truth, from 1 µs to about
+// an hour. Recording is wait-free and may happen on any thread.
+class LatencyHistogram {
+  public:
+    void record(std::chrono::nanoseconds d);
+    void reset();
+    // count, and the median, 90th and 99th percentiles and maximum in µs
+    json summary() const;
+
+  private:
+    // bucket 0 holds durations under 1 µs, bucket k those under 2^(k/4) µs
+    std::atomic<uint64_t> buckets[DDB_IPC_LATENCY_BUCKETS] = {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<int64_t> max_ns = 0;
+};
+
+// Time from receiving a request to sending its response, by priority class
+void record_request_latency(
+    CommandPriority priority, std::chrono::nanoseconds d
+);
+
+// Time pl_lock was held by the plugin, on any thread
+void record_pl_lock_hold(std::chrono::nanoseconds d);
+
+json command_get_metrics(request_id id, json args);
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef DDB_IPC_MPSC_QUEUE_HPP
+#define DDB_IPC_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+namespace ddb_ipc {
+
+// An unbounded multi-producer, single-consumer queue after Dmitry Vyukov's
+// intrusive MPSC node queue. push() is wait-free: one atomic exchange and one
+// store, so a producer never waits for the consumer or other producers. A
+// push that has exchanged the head but not yet linked its node hides it and
+// the nodes pushed after it from pop() until it completes, so producers must
+// signal the consumer only after push() returns.
+template <typename T>
+class MpscQueue {
+  public:
+    MpscQueue() : head(new Node), tail(head.load()) {}
+    ~MpscQueue() {
+        T value;
+        while (pop(value)) {
+        }
+        delete tail;
+    }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // May be called from any thread
+    void push(T value) {
+        Node* n = new Node{std::move(value)};
+        Node* prev = head.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // Consumer only; returns false if no completed push is left
+    bool pop(T& value) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        // next becomes the new stub node, with its value moved out
+        value = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+  private:
+    struct Node {
+        T value{};
+        std::atomic<Node*> next{nullptr};
+    };
+    std::atomic<Node*> head;
+    Node* tail;
+};
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef DDB_IPC_PATTERN_TRIE_HPP
+#define DDB_IPC_PATTERN_TRIE_HPP
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace ddb_ipc {
+
+// A trie of glob patterns, where `*` matches any sequence of characters and
+// `?` any single character, mapping each pattern to a set of subscribers.
+// Matching a key visits only the branches that agree with it, so for
+// patterns without `*` its cost depends on the length of the key and not on
+// the number of patterns.
+class PatternTrie {
+  public:
+    void insert(const std::string& pattern, int subscriber);
+    void erase(int subscriber);
+    void clear();
+    bool empty() const;
+    std::set<int> match(const std::string& key) const;
+    // The patterns that have subscribers
+    std::vector<std::string> patterns() const;
+
+  private:
+    struct Node {
+        std::map<char, std::unique_ptr<Node>> children;
+        std::unique_ptr<Node> any_char;
+        std::unique_ptr<Node> any_seq;
+        std::set<int> subscribers;
+        bool empty() const;
+    };
+    Node root;
+
+    static void erase(Node& node, int subscriber);
+    static void match(
+        const Node& node,
+        const std::string& key,
+        size_t pos,
+        std::set<int>& result
+    );
+    static void patterns(
+        const Node& node,
+        std::string& pattern,
+        std::vector<std::string>& result
+    );
+};
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef DDB_IPC_PLAYLIST_DIFF_HPP
+#define DDB_IPC_PLAYLIST_DIFF_HPP
+
+#include "commands.hpp"
+#include "ipc_json.hpp"
+
+namespace ddb_ipc {
+
+json command_subscribe_playlist(request_id id, json args);
+json command_unsubscribe_playlist(request_id id, json args);
+
+// Diff the subscribed playlists against their snapshots and notify
+// subscribers; may be called from any thread
+void on_playlist_content_changed();
+void drop_playlist_subscriptions(int socket);
+
+}  // namespace ddb_ipc
+
+#endif
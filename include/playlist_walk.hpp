@@ -0,0 +1,43 @@
+#ifndef DDB_IPC_PLAYLIST_WALK_HPP
+#define DDB_IPC_PLAYLIST_WALK_HPP
+
+#include <chrono>
+#include <functional>
+
+#include <deadbeef/deadbeef.h>
+
+namespace ddb_ipc {
+
+// A walk over the items of a playlist that may be long, with pl_lock held.
+// The lock is released and retaken every so many items or microseconds, as
+// configured by ddb_ipc.lock_chunk_items and ddb_ipc.lock_chunk_us, so that
+// the GUI and the streamer are not kept waiting for the whole walk. If the
+// playlist was modified while the lock was released, the walk carries on from
+// the item it holds a reference to, unless that was removed from the playlist.
+class PlaylistWalk {
+  public:
+    // pl_lock must be held
+    explicit PlaylistWalk(ddb_playlist_t* plt);
+
+    // Call before each item, with a reference to it held. At the end of a
+    // chunk, or if end_chunk is set, release pl_lock, run unlocked and retake
+    // the lock. Returns false if the item was removed meanwhile.
+    bool next(
+        DB_playItem_t* item,
+        int iter,
+        bool end_chunk = false,
+        const std::function<void()>& unlocked = nullptr
+    );
+
+  private:
+    ddb_playlist_t* plt;
+    int generation;
+    int max_items;
+    std::chrono::microseconds max_time;
+    int items = 0;
+    std::chrono::steady_clock::time_point chunk_start;
+};
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef DDB_IPC_PLAYQUEUE_HPP
+#define DDB_IPC_PLAYQUEUE_HPP
+
+#include "commands.hpp"
+#include "ipc_json.hpp"
+
+namespace ddb_ipc {
+
+json command_queue_get(request_id id, json args);
+json command_queue_add(request_id id, json args);
+json command_queue_remove(request_id id, json args);
+json command_queue_clear(request_id id, json args);
+
+// Broadcast the play queue if it changed; may be called from any thread
+void on_playqueue_changed();
+
+}  // namespace ddb_ipc
+
+#endif
@@ -1,22 +1,32 @@
 #ifndef DDB_IPC_PROPERTIES_HPP
 #define DDB_IPC_PROPERTIES_HPP
 
-#include <nlohmann/json.hpp>
 #include <set>
-using json = nlohmann::json;
 
 #include <deadbeef/deadbeef.h>
 
 #include "commands.hpp"
+#include "ipc_json.hpp"
+#include "pattern_trie.hpp"
 
 namespace ddb_ipc {
 
 // extern DB_functions_t* ddb_api;
 
+// A configuration value to be written. Setters translate property values
+// into these instead of writing them, so that several properties can be
+// validated first and then written together.
+struct ConfigWrite {
+    std::string key;
+    json value;
+};
+
 typedef json (*ipc_property_getter)();
-typedef void (*ipc_property_setter)(json);
+// Throws std::invalid_argument if the value is not valid for the property
+typedef ConfigWrite (*ipc_property_setter)(json);
 
-extern std::map<int, std::set<std::string>> observers;
+// observed property patterns, by socket
+extern PatternTrie observers;
 extern std::map<std::string, ipc_property_getter> getters;
 extern std::map<std::string, ipc_property_setter> setters;
 
@@ -27,11 +37,17 @@ json get_property_repeat();
 
 json command_get_property(request_id id, json args);
 json command_set_property(request_id id, json args);
+json command_get_properties(request_id id, json args);
+json command_set_properties(request_id id, json args);
 
 json property_as_json(std::string prop);
 
 json command_observe_property(request_id id, json args);
 
+// Send property-change events to the observers of properties affected by a
+// configuration change; may be called from any thread
+void notify_property_observers();
+
 }  // namespace ddb_ipc
 
 #endif
@@ -0,0 +1,81 @@
+#ifndef DDB_IPC_REQUEST_HPP
+#define DDB_IPC_REQUEST_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+
+#include "message.hpp"
+#include "response.hpp"
+
+namespace ddb_ipc {
+
+typedef std::chrono::steady_clock::time_point deadline_t;
+
+enum RequestState {
+    DDB_IPC_REQUEST_PENDING,
+    DDB_IPC_REQUEST_CANCELLED,
+    DDB_IPC_REQUEST_TIMED_OUT,
+    // the connection was closed, nobody is listening for the response
+    DDB_IPC_REQUEST_DROPPED,
+};
+
+// A request that is being served and may be cancelled by the client or
+// interrupted by its deadline. Only requests with a request_id or a deadline
+// are tracked.
+class PendingRequest {
+  public:
+    int socket;
+    request_id id;
+    std::optional<deadline_t> deadline;
+    // set by commands that respond from another thread; such requests are
+    // released by whoever sends the final response
+    bool asynchronous;
+    // source id of an outstanding artwork query, 0 if none
+    std::atomic<int64_t> artwork_sid;
+
+    PendingRequest(
+        int _socket, request_id _id, std::optional<deadline_t> _deadline
+    ) :
+        socket(_socket),
+        id(_id),
+        deadline(_deadline),
+        asynchronous(false),
+        artwork_sid(0),
+        _state(DDB_IPC_REQUEST_PENDING) {};
+
+    RequestState state() const { return (RequestState)_state.load(); }
+    // Move the request out of the pending state; returns false if it had
+    // already left it.
+    bool interrupt(RequestState s);
+    // Check the deadline; returns true if the request should stop.
+    bool interrupted();
+
+  private:
+    std::atomic<int> _state;
+};
+typedef std::shared_ptr<PendingRequest> pending_request_t;
+
+pending_request_t register_request(int socket, const Message& m);
+void release_request(pending_request_t req);
+
+// The request currently being dispatched on this thread, if it is tracked
+pending_request_t current_request();
+void set_current_request(pending_request_t req);
+
+// Cancel all pending requests on socket with the given id; returns the number
+// of requests cancelled
+int cancel_requests(int socket, int id);
+// Time out requests whose deadline has passed
+void expire_requests();
+// Milliseconds until the earliest deadline, -1 if there is none
+int next_deadline_ms();
+// Forget the requests of a closed connection
+void drop_requests(int socket);
+
+Response interrupted_response(const pending_request_t& req);
+
+}  // namespace ddb_ipc
+
+#endif
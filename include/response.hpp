@@ -1,9 +1,10 @@
 #ifndef DDB_IPC_RESPONSE_HPP
 #define DDB_IPC_RESPONSE_HPP
 
-#include <nlohmann/json.hpp>
-using json = nlohmann::json;
 #include <optional>
+#include <string>
+
+#include "ipc_json.hpp"
 
 namespace ddb_ipc {
 
@@ -12,6 +13,8 @@ enum ResponseStatus {
     DDB_IPC_RESPONSE_OK,
     DDB_IPC_RESPONSE_ERR,
     DDB_IPC_RESPONSE_BADQ,
+    DDB_IPC_RESPONSE_CANCELLED,
+    DDB_IPC_RESPONSE_TIMEOUT,
 };
 
 void to_json(json& j, const ResponseStatus& c);
@@ -21,13 +24,23 @@ class Response {
     ResponseStatus status;
     json data;
     Response(request_id _id, ResponseStatus _status, json _data) :
-        id(_id), status(_status), data(_data) {};
+        id(_id), status(_status), data(std::move(_data)) {};
 };
 void to_json(json& j, const Response& r);
+// Used when a command returns a temporary Response, which is the common case;
+// moves the payload instead of copying it
+void to_json(json& j, Response&& r);
 
 Response ok_response(request_id, json data = {});
 Response bad_request_response(request_id id, std::string mess);
 Response error_response(request_id id, std::string mess);
+Response cancelled_response(request_id id);
+Response timeout_response(request_id id);
+
+// Serialize a message followed by a newline into out, replacing its contents
+// but keeping its capacity. Replies that consist only of a status and a
+// request id are written from precomputed templates.
+void serialize_message(const json& j, std::string& out);
 
 }  // namespace ddb_ipc
 
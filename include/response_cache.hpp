@@ -0,0 +1,48 @@
+#ifndef DDB_IPC_RESPONSE_CACHE_HPP
+#define DDB_IPC_RESPONSE_CACHE_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ipc_json.hpp"
+#include "response.hpp"
+
+namespace ddb_ipc {
+
+// How the responses of a read-only command are cached: until one of events
+// is received, or any command without a policy is dispatched, since it may
+// change anything. Commands that change nothing a response depends on have a
+// policy that is never cacheable.
+struct CachePolicy {
+    std::vector<uint32_t> events;
+    // If set, whether a request with the given arguments may be answered
+    // from the cache right now
+    bool (*cacheable)(const json& args) = nullptr;
+};
+extern const std::map<std::string, CachePolicy> cache_policies;
+
+// The cache slot of a request, taken before it is dispatched so that events
+// received while the command runs invalidate its response
+struct CacheLookup {
+    bool cacheable = false;
+    std::string key;
+    uint64_t generation = 0;
+};
+
+// IPC thread only
+CacheLookup cache_lookup(const std::string& command, const json& args);
+// Serialize the cached response to the request into out, as
+// serialize_message would; returns false if there is none
+bool cached_response(
+    const CacheLookup& lookup, request_id id, std::string& out
+);
+void cache_response(const CacheLookup& lookup, const json& response);
+
+// May be called from any thread, i.e. DeaDBeeF's message thread
+void invalidate_cached_responses(uint32_t event);
+
+}  // namespace ddb_ipc
+
+#endif
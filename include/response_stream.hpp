@@ -0,0 +1,57 @@
+#ifndef DDB_IPC_RESPONSE_STREAM_HPP
+#define DDB_IPC_RESPONSE_STREAM_HPP
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#include "ddb_ipc.hpp"
+#include "ipc_json.hpp"
+#include "response.hpp"
+
+namespace ddb_ipc {
+
+// A response with one large array, written to the client as the array is
+// built instead of being held in memory whole. Elements are serialized into
+// the connection's output buffer, which the caller sends with flush(), e.g.
+// once it is full() and the caller holds no lock. The client receives
+//     {"<key>":[...],"request_id":N,"status":"OK"}
+// exactly as if the command had returned the document, provided that key
+// sorts before the keys of the final response. A command that streams its
+// response returns null, so that nothing else is sent. IPC thread only.
+class ResponseStream {
+  public:
+    ResponseStream(int socket, request_id id, const char* key);
+    ResponseStream(const ResponseStream&) = delete;
+    ResponseStream& operator=(const ResponseStream&) = delete;
+
+    void push_back(std::string_view element);
+    // Whether the output buffer holds DDB_IPC_STREAM_CHUNK bytes or more
+    bool full() const { return out.size() >= DDB_IPC_STREAM_CHUNK; }
+    // Send the elements serialized so far
+    void flush() { flush(false); }
+    // Close the array and send the keys of r after it. If the request was
+    // interrupted, r is its interrupted_response, which the client receives
+    // along with the elements sent so far.
+    void finish(const Response& r);
+    // Whether the connection was lost; nothing more is sent then
+    bool failed() const { return _failed; }
+
+  private:
+    void flush(bool last);
+
+    int socket;
+    request_id id;
+    std::string& out;
+    // reused for each element, so that elements do not pile up in the arena
+    json element;
+    bool first_element = true;
+    bool first_chunk = true;
+    bool _failed = false;
+    size_t sent = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+}  // namespace ddb_ipc
+
+#endif
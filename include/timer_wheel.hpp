@@ -0,0 +1,86 @@
+#ifndef DDB_IPC_TIMER_WHEEL_HPP
+#define DDB_IPC_TIMER_WHEEL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#define DDB_IPC_TIMER_WHEEL_LEVELS 4
+#define DDB_IPC_TIMER_WHEEL_BITS 6  // 64 slots per level
+
+namespace ddb_ipc {
+
+class TimerWheel;
+
+// A timer that can be armed on a TimerWheel. Its callback runs on the thread
+// that advances the wheel, after the timer has been disarmed, and may re-arm
+// it. Destroying an armed timer cancels it.
+class Timer {
+  public:
+    std::function<void()> callback;
+
+    Timer() = default;
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+    ~Timer() { cancel(); }
+
+    bool armed() const { return wheel != nullptr; }
+    void cancel();
+
+  private:
+    friend class TimerWheel;
+    // intrusive list of the slot the timer is in
+    Timer* prev = nullptr;
+    Timer* next = nullptr;
+    Timer** slot = nullptr;
+    TimerWheel* wheel = nullptr;
+    uint64_t expires = 0;
+};
+
+// A hierarchical timing wheel, as in Varghese and Lauck's scheme 7: level k
+// has 64 slots of 64^k ticks each, and timers move down a level as their
+// expiry comes within range of it. Arming and cancelling cost O(1) and
+// advancing by a tick touches one slot per level, however many timers are
+// armed. Timers expire on the first tick at or after their delay, so they
+// may fire up to one tick late. Delays beyond the range of the top level are
+// cut short to it.
+class TimerWheel {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    explicit TimerWheel(clock::duration tick);
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    ~TimerWheel();
+
+    void arm(Timer& timer, clock::duration delay);
+    // Run the callbacks of the timers that have expired by now
+    void advance(clock::time_point now = clock::now());
+    // Milliseconds until advance() next has work to do, -1 if no timer is
+    // armed. This may be early for timers on the upper levels, which only
+    // need to move down a level then.
+    int next_timeout_ms(clock::time_point now = clock::now()) const;
+
+  private:
+    friend class Timer;
+    static const int slots = 1 << DDB_IPC_TIMER_WHEEL_BITS;
+    static const uint64_t slot_mask = slots - 1;
+
+    void insert(Timer& timer);
+    void unlink(Timer& timer);
+    // Re-insert the timers of a slot, which moves them down a level
+    void cascade(int level, int slot);
+    void tick();
+
+    clock::duration tick_length;
+    clock::time_point start;
+    // ticks since start that have been processed
+    uint64_t current = 0;
+    size_t n_armed = 0;
+    // list heads of the slots
+    Timer* wheel[DDB_IPC_TIMER_WHEEL_LEVELS][slots] = {};
+};
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef DDB_IPC_TRACE_HPP
+#define DDB_IPC_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "commands.hpp"
+#include "ipc_json.hpp"
+
+namespace ddb_ipc {
+
+// Nanoseconds on the monotonic clock
+typedef int64_t trace_time_t;
+
+extern std::atomic<bool> trace_enabled;
+
+inline bool tracing() { return trace_enabled.load(std::memory_order_relaxed); }
+trace_time_t trace_now();
+
+// Record a completed span in the trace ring. name and detail are not copied
+// and must outlive the trace: use literals or keys of long-lived maps.
+void trace_span(
+    const char* name,
+    trace_time_t start,
+    trace_time_t end,
+    request_id id,
+    const char* detail = nullptr
+);
+
+// The request that spans recorded on this thread are attributed to
+void set_trace_request(request_id id);
+request_id trace_request();
+
+// Records the lifetime of the object as a span of the current request
+class TraceSpan {
+  public:
+    TraceSpan(const char* _name, const char* _detail = nullptr) :
+        name(_name), detail(_detail), start(tracing() ? trace_now() : -1) {};
+    ~TraceSpan() {
+        if (start >= 0) {
+            trace_span(name, start, trace_now(), trace_request(), detail);
+        }
+    }
+
+  private:
+    const char* name;
+    const char* detail;
+    trace_time_t start;
+};
+
+// pl_lock, recording the time spent waiting for it
+void pl_lock_traced();
+// pl_unlock, recording how long the lock was held in the histogram of
+// get-metrics. The plugin takes pl_lock only through these two.
+void pl_unlock_traced();
+
+// Enable or disable tracing according to the trace setting
+void update_tracing();
+
+json command_dump_trace(request_id id, json args);
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef DDB_IPC_VISUALIZATION_HPP
+#define DDB_IPC_VISUALIZATION_HPP
+
+#include "commands.hpp"
+#include "ipc_json.hpp"
+
+namespace ddb_ipc {
+
+json command_subscribe_visualization(request_id id, json args);
+json command_unsubscribe_visualization(request_id id, json args);
+
+// Milliseconds until a subscriber is due a frame, -1 if there are none
+int next_frame_ms();
+// Send frames to the subscribers that are due one; IPC thread only
+void send_visualization_frames();
+void drop_visualization_subscriptions(int socket);
+
+}  // namespace ddb_ipc
+
+#endif
@@ -0,0 +1,109 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+namespace ddb_ipc {
+
+thread_local Arena arena;
+
+// Precedes each allocation; its size keeps the allocation aligned for any type
+struct AllocationHeader {
+    // null for the heap
+    Arena* owner;
+    uint64_t generation;
+};
+const size_t header_size = alignof(std::max_align_t);
+static_assert(sizeof(AllocationHeader) <= header_size);
+
+AllocationHeader* header_of(void* p) {
+    return reinterpret_cast<AllocationHeader*>(
+        static_cast<char*>(p) - header_size
+    );
+}
+
+void* Arena::allocate(size_t size, size_t align) {
+    if (!blocks.empty()) {
+        Block& b = blocks.back();
+        size_t start = (used + align - 1) & ~(align - 1);
+        if (start + size <= b.size) {
+            used = start + size;
+            return b.data.get() + start;
+        }
+    }
+    // allocations larger than a block get a block of their own
+    size_t block_size = std::max(size, (size_t)DDB_IPC_ARENA_BLOCK_SIZE);
+    blocks.push_back({std::unique_ptr<char[]>(new char[block_size]), block_size}
+    );
+    used = size;
+    return blocks.back().data.get();
+}
+
+size_t Arena::size() const {
+    size_t n = 0;
+    for (auto& b : blocks) {
+        n += b.size;
+    }
+    return n;
+}
+
+void Arena::reset() {
+#if DDB_IPC_ARENA_CHECKS
+    assert(live == 0 && "arena memory outlived its ArenaScope");
+#endif
+    generation++;
+    // keep the first block unless it was made for one large allocation
+    if (!blocks.empty() && blocks[0].size > DDB_IPC_ARENA_BLOCK_SIZE) {
+        blocks.clear();
+    } else if (blocks.size() > 1) {
+        blocks.erase(blocks.begin() + 1, blocks.end());
+    }
+    used = 0;
+}
+
+void* arena_allocate(size_t size, size_t align) {
+    void* block;
+    Arena* owner = nullptr;
+    if (arena.active) {
+        owner = &arena;
+        block = arena.allocate(header_size + size, header_size);
+#if DDB_IPC_ARENA_CHECKS
+        arena.live++;
+#endif
+    } else {
+        block = ::operator new(header_size + size);
+    }
+    new (block) AllocationHeader{owner, owner ? owner->generation : 0};
+    return static_cast<char*>(block) + header_size;
+}
+
+size_t arena_size() { return arena.size(); }
+
+void arena_deallocate(void* p) {
+    AllocationHeader* h = header_of(p);
+    if (!h->owner) {
+        ::operator delete(h);
+        return;
+    }
+#if DDB_IPC_ARENA_CHECKS
+    assert(
+        h->generation == h->owner->generation &&
+        "arena memory freed after its ArenaScope"
+    );
+    h->owner->live--;
+#endif
+}
+
+ArenaScope::ArenaScope() { arena.active = true; }
+
+ArenaScope::~ArenaScope() {
+    arena.active = false;
+    arena.reset();
+}
+
+HeapScope::HeapScope() : was_active(arena.active) { arena.active = false; }
+
+HeapScope::~HeapScope() { arena.active = was_active; }
+
+}  // namespace ddb_ipc
@@ -0,0 +1,160 @@
+#include "capture.hpp"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ddb_ipc.hpp"
+
+namespace ddb_ipc {
+
+// capturing is checked without the lock so that it costs nothing when off
+std::atomic<bool> capturing = false;
+std::mutex capture_mutex;
+FILE* capture_file = nullptr;
+std::string capture_path;
+std::chrono::steady_clock::time_point capture_start;
+// connection number of each open socket
+std::unordered_map<int, unsigned> capture_connections;
+unsigned next_connection = 1;
+// set while a message sent in parts has been recorded only partly
+bool record_open = false;
+
+void write_record_header(unsigned conn, char kind) {
+    // a message whose sending failed midway ends where the client lost it,
+    // so that the record of the failure goes on a line of its own
+    if (record_open) {
+        fputc('\n', capture_file);
+        record_open = false;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - capture_start
+    );
+    fprintf(capture_file, "%lld %u %c ", (long long)us.count(), conn, kind);
+}
+
+void write_record(unsigned conn, char kind, std::string_view message) {
+    write_record_header(conn, kind);
+    fwrite(message.data(), 1, message.size(), capture_file);
+    fputc('\n', capture_file);
+}
+
+void close_capture() {
+    if (capture_file) {
+        if (record_open) {
+            fputc('\n', capture_file);
+        }
+        fclose(capture_file);
+        capture_file = nullptr;
+    }
+    capture_path.clear();
+    capture_connections.clear();
+    record_open = false;
+    capturing = false;
+}
+
+void update_capture() {
+    char path[PATH_MAX];
+    ddb_api->conf_get_str(
+        DDB_IPC_PROJECT_ID ".capture_path", "", path, sizeof(path)
+    );
+    std::lock_guard lock(capture_mutex);
+    if (capture_path == path) {
+        return;
+    }
+    auto logger = get_logger();
+    if (capture_file) {
+        logger->info("Stopped capturing to {}.", capture_path);
+    }
+    close_capture();
+    if (path[0] == '\0') {
+        return;
+    }
+    capture_file = fopen(path, "we");
+    if (!capture_file) {
+        logger->error("Failed to open capture file {}: {}.", path, errno);
+        return;
+    }
+    fputs("# ddb_ipc capture 1\n", capture_file);
+    capture_path = path;
+    capture_start = std::chrono::steady_clock::now();
+    next_connection = 1;
+    capturing = true;
+    logger->info("Capturing traffic to {}.", capture_path);
+}
+
+void stop_capture() {
+    std::lock_guard lock(capture_mutex);
+    close_capture();
+}
+
+void capture_connected(int socket) {
+    if (!capturing) {
+        return;
+    }
+    std::lock_guard lock(capture_mutex);
+    if (!capture_file) {
+        return;
+    }
+    unsigned conn = next_connection++;
+    capture_connections[socket] = conn;
+    write_record(conn, '+', "");
+}
+
+void capture_disconnected(int socket) {
+    if (!capturing) {
+        return;
+    }
+    std::lock_guard lock(capture_mutex);
+    auto it = capture_connections.find(socket);
+    if (!capture_file || it == capture_connections.end()) {
+        return;
+    }
+    write_record(it->second, '-', "");
+    capture_connections.erase(it);
+    // a good moment to make the records so far visible on disk
+    fflush(capture_file);
+}
+
+void capture_message(int socket, char kind, std::string_view message) {
+    if (!capturing) {
+        return;
+    }
+    std::lock_guard lock(capture_mutex);
+    auto it = capture_connections.find(socket);
+    // connections that were open when the capture started are not recorded,
+    // a replay could not reproduce their earlier requests
+    if (!capture_file || it == capture_connections.end()) {
+        return;
+    }
+    write_record(it->second, kind, message);
+}
+
+void capture_message_part(
+    int socket, char kind, std::string_view part, bool first, bool last
+) {
+    if (!capturing) {
+        return;
+    }
+    std::lock_guard lock(capture_mutex);
+    auto it = capture_connections.find(socket);
+    if (!capture_file || it == capture_connections.end()) {
+        return;
+    }
+    if (first) {
+        write_record_header(it->second, kind);
+    }
+    fwrite(part.data(), 1, part.size(), capture_file);
+    if (last) {
+        fputc('\n', capture_file);
+    }
+    record_open = !last;
+}
+
+}  // namespace ddb_ipc
@@ -4,11 +4,13 @@
 #include <deadbeef/deadbeef.h>
 #include <deadbeef/artwork.h>
 // clang-format on
+#include <fcntl.h>
 #include <limits.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
-#include <nlohmann/json.hpp>
 #include <optional>
 #include <random>
 #include <stdexcept>
@@ -16,11 +18,23 @@
 
 #include "../submodules/cpp-base64/base64.h"
 #include "argument.hpp"
+#include "cover_art.hpp"
 #include "ddb_ipc.hpp"
+#include "event_log.hpp"
+#include "format_pool.hpp"
+#include "format_subscription.hpp"
+#include "ipc_json.hpp"
+#include "metrics.hpp"
+#include "playlist_diff.hpp"
+#include "playlist_walk.hpp"
+#include "playqueue.hpp"
 #include "properties.hpp"
+#include "request.hpp"
 #include "response.hpp"
-
-using json = nlohmann::json;
+#include "response_cache.hpp"
+#include "response_stream.hpp"
+#include "trace.hpp"
+#include "visualization.hpp"
 namespace ddb_ipc {
 
 COMMAND(play, Argument) {
@@ -42,7 +56,7 @@ class PlayNumArgument : Argument {
   public:
     int idx;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(PlayNumArgument, idx);
+DDB_IPC_DEFINE_TYPE(PlayNumArgument, idx);
 COMMAND(play_num, PlayNumArgument) {
     ddb_api->sendmessage(DB_EV_PLAY_NUM, 0, args.idx, 0);
     return ok_response(id);
@@ -104,7 +118,7 @@ class SetVolumeArgument : Argument {
   public:
     float volume;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(SetVolumeArgument, volume);
+DDB_IPC_DEFINE_TYPE(SetVolumeArgument, volume);
 
 COMMAND(set_volume, SetVolumeArgument) {
     float vol = args.volume;
@@ -122,7 +136,7 @@ class AdjustVolumeArgument : Argument {
   public:
     float adjustment;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(AdjustVolumeArgument, adjustment);
+DDB_IPC_DEFINE_TYPE(AdjustVolumeArgument, adjustment);
 
 COMMAND(adjust_volume, AdjustVolumeArgument) {
     float adj = args.adjustment / 100;
@@ -228,7 +242,7 @@ class GetNowPlayingArgument : Argument {
   public:
     std::string format = DDB_IPC_DEFAULT_FORMAT;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GetNowPlayingArgument, format);
+DDB_IPC_DEFINE_TYPE_WITH_DEFAULT(GetNowPlayingArgument, format);
 
 COMMAND(get_now_playing, GetNowPlayingArgument) {
     DB_playItem_t* cur = ddb_api->streamer_get_playing_track();
@@ -253,6 +267,7 @@ COMMAND(get_now_playing, GetNowPlayingArgument) {
     if (code == NULL) {
         resp = error_response(id, "Compilation of title format failed.");
     } else {
+        TraceSpan span("tf");
         ddb_api->tf_eval(&ctx, code, buf, 4096);
         ddb_api->tf_free(code);
         resp = ok_response(id);
@@ -279,11 +294,40 @@ COMMAND(get_current_playlist, Argument) {
     return resp;
 }
 
+COMMAND(list_playlists, Argument) {
+    char buf[4096];
+    json playlists = json::array();
+    pl_lock_traced();
+    int count = ddb_api->plt_get_count();
+    for (int idx = 0; idx < count; idx++) {
+        ddb_playlist_t* plt = ddb_api->plt_get_for_idx(idx);
+        if (!plt) {
+            continue;
+        }
+        ddb_api->plt_get_title(plt, buf, sizeof(buf));
+        playlists.push_back({
+            {"idx", idx},
+            {"title", std::string(buf)},
+            {"count", ddb_api->plt_get_item_count(plt, PL_MAIN)},
+            {"duration", ddb_api->plt_get_totaltime(plt)},
+            {"generation", ddb_api->plt_get_modification_idx(plt)},
+        });
+        ddb_api->plt_unref(plt);
+    }
+    int curr_idx = ddb_api->plt_get_curr_idx();
+    pl_unlock_traced();
+
+    json resp = ok_response(id);
+    resp["playlists"] = playlists;
+    resp["current"] = curr_idx;
+    return resp;
+}
+
 class SetCurrPlaylistArgument : Argument {
   public:
     int idx;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(SetCurrPlaylistArgument, idx);
+DDB_IPC_DEFINE_TYPE(SetCurrPlaylistArgument, idx);
 COMMAND(set_current_playlist, SetCurrPlaylistArgument) {
     ddb_api->plt_set_curr_idx(args.idx);
     int curr_idx = ddb_api->plt_get_curr_idx();
@@ -298,55 +342,229 @@ class GetPlaylistContentsArgument : Argument {
   public:
     int idx;
     std::string format = DDB_IPC_DEFAULT_FORMAT;
+    int start = 0;
+    int socket;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(
-    GetPlaylistContentsArgument, idx, format
+DDB_IPC_DEFINE_TYPE_WITH_DEFAULT(
+    GetPlaylistContentsArgument, idx, format, start, socket
 );
 COMMAND(get_playlist_contents, GetPlaylistContentsArgument) {
     int iter = PL_MAIN;
-    ddb_api->pl_lock();
+    pl_lock_traced();
     ddb_playlist_t* plt = ddb_api->plt_get_for_idx(args.idx);
     if (!plt) {
-        ddb_api->pl_unlock();
+        pl_unlock_traced();
         return error_response(id, "No playlist with given idx.");
     }
 
     const char* fmt = args.format.c_str();
     char* code = ddb_api->tf_compile(fmt);
     if (code == NULL) {
+        ddb_api->plt_unref(plt);
+        pl_unlock_traced();
         return error_response(id, "Compilation of title format failed.");
     }
 
-    json resp = ok_response(id);
-    int count = ddb_api->plt_get_item_count(plt, iter);
-    std::vector<std::string> items{};
-    items.reserve(count);
-    char buf[4096];
-    memset(buf, '\0', sizeof(buf));
+    pending_request_t req = current_request();
+    // the items are sent as they are formatted, as there may be many
+    ResponseStream stream(args.socket, id, "items");
+    // Items are taken a batch at a time with the lock held, then formatted
+    // in parallel and sent with it released. A batch ends with each chunk of
+    // the walk, so the snapshot it holds references to is consistent.
+    std::vector<DB_playItem_t*> batch;
+    std::vector<std::string> formatted;
+    batch.reserve(DDB_IPC_FORMAT_BATCH);
+    auto release_batch = [&]() {
+        for (DB_playItem_t* it : batch) {
+            ddb_api->pl_item_unref(it);
+        }
+        batch.clear();
+    };
+    auto send_batch = [&]() {
+        formatted.resize(batch.size());
+        format_items(code, batch.data(), batch.size(), iter, formatted.data());
+        release_batch();
+        for (auto& item : formatted) {
+            stream.push_back(item);
+        }
+        stream.flush();
+    };
 
-    ddb_tf_context_t ctx;
-    ddb_playItem_t* prev;
-    ddb_playItem_t* cur = ddb_api->plt_get_head_item(plt, iter);
+    ddb_playItem_t* cur = ddb_api->plt_get_item_for_idx(plt, args.start, iter);
+    PlaylistWalk walk(plt);
+    // set if the walk lost its place, at the index to continue from
+    std::optional<int> next;
+    int taken = 0;
+    int n = 0;
+    trace_time_t tf_start = tracing() ? trace_now() : -1;
     while (cur != NULL) {
-        ctx = {
-            ._size = sizeof(ddb_tf_context_t),
-            .flags = 0,
-            .it = cur,
-            .plt = NULL,
-            .idx = 0,
-            .id = 0,
-            .iter = iter,
-        };
-        ddb_api->tf_eval(&ctx, code, buf, sizeof(buf));
-        items.push_back(buf);
+        // checking the clock on every item would dominate the walk
+        if (stream.failed() ||
+            (req && (++n % DDB_IPC_INTERRUPT_CHECK_ITEMS) == 0 &&
+             req->interrupted()))
+        {
+            ddb_api->pl_item_unref(cur);
+            break;
+        }
+        if (!walk.next(
+                cur, iter, batch.size() >= DDB_IPC_FORMAT_BATCH, send_batch
+            ))
+        {
+            next = args.start + taken;
+            ddb_api->pl_item_unref(cur);
+            break;
+        }
+        // the batch keeps the reference
+        batch.push_back(cur);
+        taken++;
+        cur = ddb_api->pl_get_next(cur, iter);
+    }
+    pl_unlock_traced();
+    if (stream.failed() || (req && req->state() != DDB_IPC_REQUEST_PENDING)) {
+        release_batch();
+    } else {
+        send_batch();
+    }
+    if (tf_start >= 0) {
+        trace_span("tf", tf_start, trace_now(), id, "items");
+    }
+    ddb_api->tf_free(code);
+    ddb_api->plt_unref(plt);
+    if (req && req->state() != DDB_IPC_REQUEST_PENDING) {
+        stream.finish(interrupted_response(req));
+    } else if (next) {
+        stream.finish(ok_response(id, {{"next", next.value()}}));
+    } else {
+        stream.finish(ok_response(id));
+    }
+    return nullptr;
+}
+
+typedef json (*ipc_track_field)(DB_playItem_t*);
+
+json track_meta(DB_playItem_t* it, const char* key) {
+    const char* val = ddb_api->pl_find_meta(it, key);
+    return val ? json(val) : json(nullptr);
+}
+
+// fields that are not plain metadata; everything else is looked up with
+// pl_find_meta
+std::map<std::string, ipc_track_field> track_fields = {
+    {"duration",
+     [](DB_playItem_t* it) -> json {
+         return ddb_api->pl_get_item_duration(it);
+     }},
+    {"path", [](DB_playItem_t* it) { return track_meta(it, ":URI"); }},
+    {"replaygain_album_gain",
+     [](DB_playItem_t* it) -> json {
+         return ddb_api->pl_get_item_replaygain(it, DDB_REPLAYGAIN_ALBUMGAIN);
+     }},
+    {"replaygain_album_peak",
+     [](DB_playItem_t* it) -> json {
+         return ddb_api->pl_get_item_replaygain(it, DDB_REPLAYGAIN_ALBUMPEAK);
+     }},
+    {"replaygain_track_gain",
+     [](DB_playItem_t* it) -> json {
+         return ddb_api->pl_get_item_replaygain(it, DDB_REPLAYGAIN_TRACKGAIN);
+     }},
+    {"replaygain_track_peak",
+     [](DB_playItem_t* it) -> json {
+         return ddb_api->pl_get_item_replaygain(it, DDB_REPLAYGAIN_TRACKPEAK);
+     }},
+};
+
+class GetTracksArgument : Argument {
+  public:
+    int idx;
+    int start = 0;
+    std::optional<int> count = {};
+    std::vector<std::string> keys;
+};
+void from_json(const json& j, GetTracksArgument& a) {
+    a.idx = j.at("idx");
+    a.keys = j.at("keys").get<std::vector<std::string>>();
+    if (j.contains("start")) {
+        a.start = j.at("start");
+    }
+    if (j.contains("count")) {
+        a.count = j.at("count").get<int>();
+    }
+    if (a.keys.empty()) {
+        throw std::invalid_argument("Argument keys must not be empty.");
+    }
+    if (a.start < 0 || (a.count && a.count.value() < 0)) {
+        throw std::invalid_argument(
+            "Arguments start and count must be non-negative."
+        );
+    }
+}
+COMMAND(get_tracks, GetTracksArgument) {
+    int iter = PL_MAIN;
+    pl_lock_traced();
+    ddb_playlist_t* plt = ddb_api->plt_get_for_idx(args.idx);
+    if (!plt) {
+        pl_unlock_traced();
+        return error_response(id, "No playlist with given idx.");
+    }
+
+    int total = ddb_api->plt_get_item_count(plt, iter);
+    int count = std::max(0, total - args.start);
+    if (args.count) {
+        count = std::min(count, args.count.value());
+    }
+    std::vector<ipc_track_field> fields;
+    std::vector<std::vector<json>> columns(args.keys.size());
+    for (size_t k = 0; k < args.keys.size(); k++) {
+        auto f = track_fields.find(args.keys[k]);
+        fields.push_back(f != track_fields.end() ? f->second : NULL);
+        columns[k].reserve(count);
+    }
+
+    pending_request_t req = current_request();
+    DB_playItem_t* prev;
+    DB_playItem_t* cur =
+        count > 0 ? ddb_api->plt_get_item_for_idx(plt, args.start, iter) : NULL;
+    PlaylistWalk walk(plt);
+    bool stopped = false;
+    for (int n = 0; cur != NULL && n < count; n++) {
+        if (req && ((n + 1) % DDB_IPC_INTERRUPT_CHECK_ITEMS) == 0 &&
+            req->interrupted())
+        {
+            break;
+        }
+        if (!walk.next(cur, iter)) {
+            stopped = true;
+            break;
+        }
+        for (size_t k = 0; k < fields.size(); k++) {
+            columns[k].push_back(
+                fields[k] ? fields[k](cur)
+                          : track_meta(cur, args.keys[k].c_str())
+            );
+        }
         prev = cur;
         cur = ddb_api->pl_get_next(prev, iter);
         ddb_api->pl_item_unref(prev);
     }
-    ddb_api->tf_free(code);
+    if (cur != NULL) {
+        ddb_api->pl_item_unref(cur);
+    }
     ddb_api->plt_unref(plt);
-    ddb_api->pl_unlock();
-    resp["items"] = items;
+    pl_unlock_traced();
+    if (req && req->state() != DDB_IPC_REQUEST_PENDING) {
+        return interrupted_response(req);
+    }
+
+    json resp = ok_response(id);
+    resp["start"] = args.start;
+    resp["count"] = columns[0].size();
+    if (stopped) {
+        resp["next"] = args.start + columns[0].size();
+    }
+    resp["columns"] = json::object();
+    for (size_t k = 0; k < args.keys.size(); k++) {
+        resp["columns"][args.keys[k]] = std::move(columns[k]);
+    }
     return resp;
 }
 
@@ -384,35 +602,44 @@ typedef std::set<std::string> accept_t;
 accept_t cover_art_formats = {
     "filename",
     "blob",
+    "fd",
 };
 
 typedef struct {
     int socket;
     request_id id;
     accept_t* accept;
+    pending_request_t request;
+    // when the artwork plugin was queried, -1 if not traced
+    trace_time_t queried;
 } response_addr_t;
 
-void callback_cover_art_found(
-    int error, ddb_cover_query_t* query, ddb_cover_info_t* cover
-) {
+// Send the cover art response for addr and dispose of it. filename is NULL if
+// no cover art was found.
+void respond_cover_art(response_addr_t* addr, const char* filename) {
     auto logger = get_logger();
-    response_addr_t* addr = (response_addr_t*)(query->user_data);
     json resp;
-    logger->debug("Entered cover art callback for descriptor {}", addr->socket);
-    if ((query->flags & DDB_ARTWORK_FLAG_CANCELLED) || cover == NULL ||
-        cover->image_filename == NULL)
-    {
+    int cover_fd = -1;
+    pending_request_t req = addr->request;
+    if (addr->queried >= 0) {
+        trace_span("artwork", addr->queried, trace_now(), addr->id);
+    }
+    if (req && req->state() != DDB_IPC_REQUEST_PENDING) {
+        if (req->state() != DDB_IPC_REQUEST_DROPPED) {
+            resp = interrupted_response(req);
+        }
+    } else if (filename == NULL) {
         resp = error_response(addr->id, "No cover art found");
     } else {
         resp = ok_response(addr->id);
         if (addr->accept->count("filename") > 0) {
             logger->debug("Responding with filename.");
-            resp["filename"] = cover->image_filename;
+            resp["filename"] = filename;
         }
         if (addr->accept->count("blob") > 0) {
             logger->debug("Responding with blob.");
             std::ifstream cover_file(
-                cover->image_filename, std::ios::binary | std::ios::ate
+                filename, std::ios::binary | std::ios::ate
             );
             std::streamsize cover_size = cover_file.tellg();
             cover_file.seekg(0, std::ios::beg);
@@ -423,11 +650,51 @@ void callback_cover_art_found(
             resp["blob"] = cover_base64;
             free(buffer);
         }
+        if (addr->accept->count("fd") > 0) {
+            logger->debug("Responding with file descriptor.");
+            cover_fd = open(filename, O_RDONLY | O_CLOEXEC);
+            if (cover_fd < 0) {
+                logger->warn("Failed to open {}: {}.", filename, errno);
+                resp = error_response(addr->id, "Failed to open cover art");
+            } else {
+                resp["fd"] = true;
+            }
+        }
     }
-    send_response(resp, addr->socket);
+    // leave the socket I/O to the IPC thread, which also knows whether the
+    // connection is still there
+    post([resp, socket = addr->socket, cover_fd, req]() {
+        if (!resp.is_null() &&
+            !(req && req->state() == DDB_IPC_REQUEST_DROPPED))
+        {
+            send_response(resp, socket, cover_fd);
+        }
+        if (cover_fd > -1) {
+            close(cover_fd);
+        }
+        if (req) {
+            release_request(req);
+        }
+    });
+    delete addr->accept;
+    delete addr;
+}
+
+void callback_cover_art_found(
+    int error, ddb_cover_query_t* query, ddb_cover_info_t* cover
+) {
+    auto logger = get_logger();
+    response_addr_t* addr = (response_addr_t*)(query->user_data);
+    logger->debug("Entered cover art callback for descriptor {}", addr->socket);
+    const char* filename = NULL;
+    if (!(query->flags & DDB_ARTWORK_FLAG_CANCELLED) && cover != NULL &&
+        cover->image_filename != NULL)
+    {
+        filename = cover->image_filename;
+        cache_cover_art(query->track, filename);
+    }
+    respond_cover_art(addr, filename);
     ddb_api->pl_item_unref(query->track);
-    free(addr->accept);
-    free(query->user_data);
     free(query);
 }
 
@@ -468,6 +735,27 @@ COMMAND(request_cover_art, RequestCoverArtArgument) {
     if (!cur) {
         return error_response(id, "Not playing");
     }
+    pending_request_t req = current_request();
+    if (req) {
+        // the request stays pending until the cover art response is sent
+        req->asynchronous = true;
+    }
+    response_addr_t* addr = new response_addr_t{
+        .socket = args.socket,
+        .id = id,
+        .accept = new accept_t(args.accept),
+        .request = req,
+        .queried = -1,
+    };
+    std::optional<std::string> cached = cached_cover_art(cur);
+    if (cached) {
+        logger->debug("Cover art request hit the cache.");
+        ddb_api->pl_item_unref(cur);
+        defer([addr, filename = cached.value()]() {
+            respond_cover_art(addr, filename.c_str());
+        });
+        return ok_response(id);
+    }
     int64_t sid = dist(mersenne_twister);
     logger->debug("Received cover art request, dispatching with sid={}.", sid);
     ddb_cover_query_t* cover_query =
@@ -475,59 +763,172 @@ COMMAND(request_cover_art, RequestCoverArtArgument) {
     cover_query->flags = 0;
     cover_query->track = (DB_playItem_t*)cur;
     cover_query->source_id = sid;
-    cover_query->user_data = malloc(sizeof(response_addr_t));
     cover_query->_size = sizeof(ddb_cover_query_t);
-    response_addr_t addr = {
-        .socket = args.socket,
-        .id = id,
-        .accept = new accept_t(args.accept),
-    };
-    *(response_addr_t*)cover_query->user_data = addr;
+    cover_query->user_data = addr;
+    if (req) {
+        req->artwork_sid = sid;
+    }
+    addr->queried = tracing() ? trace_now() : -1;
     ddb_artwork->cover_get(cover_query, callback_cover_art_found);
     logger->debug("Sent cover art query");
     return ok_response(id);
 }
 
-std::map<std::string, ipc_command> commands = {
+class CancelArgument : Argument {
+  public:
+    int request_id;
+    int socket;
+};
+DDB_IPC_DEFINE_TYPE(CancelArgument, request_id, socket);
+COMMAND(cancel, CancelArgument) {
+    if (cancel_requests(args.socket, args.request_id) == 0) {
+        return error_response(
+            id,
+            "No pending request with request_id " +
+                std::to_string(args.request_id) + "."
+        );
+    }
+    return ok_response(id);
+}
+
+// Any message restarts the connection's idle timer; this one is for clients
+// with nothing else to say when pinged
+COMMAND(pong, Argument) { return ok_response(id); }
+
+std::map<std::string, CommandSpec> commands = {
     // playback
-    {"play", command_play},
-    {"pause", command_pause},
-    {"play-pause", command_play_pause},
-    {"play-num", command_play_num},
-    {"prev-track", command_prev},
-    {"next-track", command_next},
-    {"prev-album", command_prev_album},
-    {"next-album", command_next_album},
-    {"stop", command_stop},
-    {"set-volume", command_set_volume},
-    {"adjust-volume", command_adjust_volume},
-    {"toggle-mute", command_toggle_mute},
-    {"seek", command_seek},
+    {"play", {command_play, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"pause", {command_pause, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"play-pause", {command_play_pause, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"play-num", {command_play_num, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"prev-track", {command_prev, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"next-track", {command_next, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"prev-album", {command_prev_album, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"next-album", {command_next_album, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"stop", {command_stop, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"set-volume", {command_set_volume, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"adjust-volume", {command_adjust_volume, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"toggle-mute", {command_toggle_mute, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"seek", {command_seek, DDB_IPC_PRIORITY_INTERACTIVE}},
     // info
-    {"get-playpos", command_get_playpos},
-    {"get-now-playing", command_get_now_playing},
-    {"request-cover-art", command_request_cover_art},
-    {"get-current-playlist", command_get_current_playlist},
-    {"set-current-playlist", command_set_current_playlist},
-    {"get-playlist-contents", command_get_playlist_contents},
+    {"get-playpos", {command_get_playpos, DDB_IPC_PRIORITY_NORMAL}},
+    {"get-now-playing", {command_get_now_playing, DDB_IPC_PRIORITY_NORMAL}},
+    {"request-cover-art", {command_request_cover_art, DDB_IPC_PRIORITY_BULK}},
+    {"get-current-playlist",
+     {command_get_current_playlist, DDB_IPC_PRIORITY_NORMAL}},
+    {"list-playlists", {command_list_playlists, DDB_IPC_PRIORITY_NORMAL}},
+    {"set-current-playlist",
+     {command_set_current_playlist, DDB_IPC_PRIORITY_NORMAL}},
+    {"get-playlist-contents",
+     {command_get_playlist_contents, DDB_IPC_PRIORITY_BULK}},
+    {"get-tracks", {command_get_tracks, DDB_IPC_PRIORITY_BULK}},
+    // play queue
+    {"queue-get", {command_queue_get, DDB_IPC_PRIORITY_NORMAL}},
+    {"queue-add", {command_queue_add, DDB_IPC_PRIORITY_NORMAL}},
+    {"queue-remove", {command_queue_remove, DDB_IPC_PRIORITY_NORMAL}},
+    {"queue-clear", {command_queue_clear, DDB_IPC_PRIORITY_NORMAL}},
+    {"subscribe-playlist",
+     {command_subscribe_playlist, DDB_IPC_PRIORITY_NORMAL}},
+    {"unsubscribe-playlist",
+     {command_unsubscribe_playlist, DDB_IPC_PRIORITY_NORMAL}},
+    // visualization
+    {"subscribe-visualization",
+     {command_subscribe_visualization, DDB_IPC_PRIORITY_NORMAL}},
+    {"unsubscribe-visualization",
+     {command_unsubscribe_visualization, DDB_IPC_PRIORITY_NORMAL}},
+    {"subscribe-format", {command_subscribe_format, DDB_IPC_PRIORITY_NORMAL}},
+    {"unsubscribe-format",
+     {command_unsubscribe_format, DDB_IPC_PRIORITY_NORMAL}},
     // playback control
     {"toggle-stop-after-current-track",
-     command_toggle_stop_after_current_track},
+     {command_toggle_stop_after_current_track, DDB_IPC_PRIORITY_INTERACTIVE}},
     {"toggle-stop-after-current-album",
-     command_toggle_stop_after_current_album},
+     {command_toggle_stop_after_current_album, DDB_IPC_PRIORITY_INTERACTIVE}},
     // properties
-    {"get-property", command_get_property},
-    {"set-property", command_set_property},
-    {"observe-property", command_observe_property}
+    {"get-property", {command_get_property, DDB_IPC_PRIORITY_NORMAL}},
+    {"set-property", {command_set_property, DDB_IPC_PRIORITY_NORMAL}},
+    {"get-properties", {command_get_properties, DDB_IPC_PRIORITY_NORMAL}},
+    {"set-properties", {command_set_properties, DDB_IPC_PRIORITY_NORMAL}},
+    {"observe-property", {command_observe_property, DDB_IPC_PRIORITY_NORMAL}},
+    // requests
+    {"cancel", {command_cancel, DDB_IPC_PRIORITY_INTERACTIVE}},
+    {"resume", {command_resume, DDB_IPC_PRIORITY_NORMAL}},
+    {"pong", {command_pong, DDB_IPC_PRIORITY_INTERACTIVE}},
+    // diagnostics
+    {"dump-trace", {command_dump_trace, DDB_IPC_PRIORITY_NORMAL}},
+    {"get-metrics", {command_get_metrics, DDB_IPC_PRIORITY_NORMAL}},
+};
+
+// Title formats with these fields change as the track plays, without an event
+const char* volatile_fields[] = {
+    "playback_time", "isplaying", "ispaused", "bitrate", "$rand"
+};
+
+bool now_playing_cacheable(const json& args) {
+    auto format = args.find("format");
+    if (format == args.end()) {
+        return true;
+    }
+    if (!format->is_string()) {
+        return false;
+    }
+    auto& f = format->get_ref<const std::string&>();
+    for (const char* field : volatile_fields) {
+        if (f.find(field) != std::string::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The position only stands still when playback does
+bool playpos_cacheable(const json& args) {
+    DB_output_t* output = ddb_api->get_output();
+    return output && output->state() != DDB_PLAYBACK_STATE_PLAYING;
+}
+
+bool never_cacheable(const json& args) { return false; }
+
+const std::map<std::string, CachePolicy> cache_policies = {
+    {"get-now-playing",
+     {{DB_EV_SONGCHANGED, DB_EV_TRACKINFOCHANGED, DB_EV_PLAYLISTCHANGED},
+      now_playing_cacheable}},
+    {"get-playpos",
+     {{DB_EV_SONGCHANGED, DB_EV_PAUSED, DB_EV_SEEKED}, playpos_cacheable}},
+    {"get-current-playlist",
+     {{DB_EV_PLAYLISTSWITCHED, DB_EV_PLAYLISTCHANGED}}},
+    {"get-property", {{DB_EV_CONFIGCHANGED, DB_EV_VOLUMECHANGED}}},
+    {"get-properties", {{DB_EV_CONFIGCHANGED, DB_EV_VOLUMECHANGED}}},
+    // not cached, but they do not invalidate the cache either
+    {"request-cover-art", {{}, never_cacheable}},
+    {"list-playlists", {{}, never_cacheable}},
+    {"get-playlist-contents", {{}, never_cacheable}},
+    {"get-tracks", {{}, never_cacheable}},
+    {"queue-get", {{}, never_cacheable}},
+    {"subscribe-playlist", {{}, never_cacheable}},
+    {"unsubscribe-playlist", {{}, never_cacheable}},
+    {"subscribe-visualization", {{}, never_cacheable}},
+    {"unsubscribe-visualization", {{}, never_cacheable}},
+    {"subscribe-format", {{}, never_cacheable}},
+    {"unsubscribe-format", {{}, never_cacheable}},
+    {"observe-property", {{}, never_cacheable}},
+    {"cancel", {{}, never_cacheable}},
+    {"resume", {{}, never_cacheable}},
+    {"pong", {{}, never_cacheable}},
+    {"dump-trace", {{}, never_cacheable}},
+    {"get-metrics", {{}, never_cacheable}},
 };
 
 json call_command(std::string command, request_id id, json args) {
     json response;
+    auto it = commands.find(command);
+    if (it == commands.end()) {
+        return error_response(id, std::string("Unknown command ") + command);
+    }
+    // the key outlives the trace, unlike command
+    TraceSpan span("dispatch", it->first.c_str());
     try {
-        response = commands.at(command)(id, args);
-    } catch (std::out_of_range& e) {
-        response =
-            error_response(id, std::string("Unknown command ") + command);
+        response = it->second.call(id, args);
     } catch (json::out_of_range& e) {
         response = bad_request_response(id, e.what());
     } catch (json::type_error& e) {
@@ -536,7 +937,17 @@ json call_command(std::string command, request_id id, json args) {
         response = bad_request_response(id, e.what());
     } catch (std::invalid_argument& e) {
         response = bad_request_response(id, e.what());
+    } catch (std::out_of_range& e) {
+        response = error_response(id, e.what());
     }
     return response;
 }
+
+CommandPriority command_priority(const std::string& command) {
+    auto it = commands.find(command);
+    if (it == commands.end()) {
+        return DDB_IPC_PRIORITY_NORMAL;
+    }
+    return it->second.priority;
+}
 }  // namespace ddb_ipc
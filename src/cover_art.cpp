@@ -0,0 +1,157 @@
+#include "cover_art.hpp"
+
+// clang-format off
+#include <deadbeef/deadbeef.h>
+#include <deadbeef/artwork.h>
+// clang-format on
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <list>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "ddb_ipc.hpp"
+#include "trace.hpp"
+
+namespace ddb_ipc {
+
+// most recently used first, keyed by track URI
+std::list<std::pair<std::string, std::string>> cover_art_cache;
+std::mutex cover_art_cache_mutex;
+int64_t prefetch_sid = 0;
+
+std::string track_uri(DB_playItem_t* track) {
+    pl_lock_traced();
+    const char* uri = ddb_api->pl_find_meta(track, ":URI");
+    std::string key = uri ? uri : "";
+    pl_unlock_traced();
+    return key;
+}
+
+std::optional<std::string> cached_cover_art(DB_playItem_t* track) {
+    std::string key = track_uri(track);
+    std::lock_guard lock(cover_art_cache_mutex);
+    for (auto it = cover_art_cache.begin(); it != cover_art_cache.end(); it++)
+    {
+        if (it->first != key) {
+            continue;
+        }
+        // the artwork plugin may have evicted the file from its own cache
+        if (access(it->second.c_str(), R_OK) != 0) {
+            cover_art_cache.erase(it);
+            return {};
+        }
+        cover_art_cache.splice(cover_art_cache.begin(), cover_art_cache, it);
+        return it->second;
+    }
+    return {};
+}
+
+void cache_cover_art(DB_playItem_t* track, std::string filename) {
+    std::string key = track_uri(track);
+    if (key.empty()) {
+        return;
+    }
+    std::lock_guard lock(cover_art_cache_mutex);
+    for (auto it = cover_art_cache.begin(); it != cover_art_cache.end(); it++)
+    {
+        if (it->first == key) {
+            cover_art_cache.erase(it);
+            break;
+        }
+    }
+    cover_art_cache.emplace_front(key, filename);
+    if (cover_art_cache.size() > DDB_IPC_COVER_ART_CACHE_SIZE) {
+        cover_art_cache.pop_back();
+    }
+}
+
+void callback_cover_art_prefetched(
+    int error, ddb_cover_query_t* query, ddb_cover_info_t* cover
+) {
+    if (!(query->flags & DDB_ARTWORK_FLAG_CANCELLED) && cover != NULL &&
+        cover->image_filename != NULL)
+    {
+        get_logger()->debug("Prefetched cover art {}.", cover->image_filename);
+        cache_cover_art(query->track, cover->image_filename);
+    }
+    ddb_api->pl_item_unref(query->track);
+    free(query);
+}
+
+// Returns up to n referenced tracks that will play after the current one: the
+// play queue, followed by the playlist if the playback order is linear.
+std::vector<DB_playItem_t*> upcoming_tracks(int n) {
+    std::vector<DB_playItem_t*> tracks;
+    pl_lock_traced();
+    int queued = ddb_api->playqueue_get_count();
+    for (int i = 0; i < queued && (int)tracks.size() < n; i++) {
+        DB_playItem_t* it = ddb_api->playqueue_get_item(i);
+        if (it) {
+            tracks.push_back(it);
+        }
+    }
+    // playback resumes after the last queued track; with shuffle there is no
+    // telling what comes next
+    int order = ddb_api->conf_get_int("playback.order", DDB_SHUFFLE_OFF);
+    DB_playItem_t* it = NULL;
+    if ((int)tracks.size() < n && order == DDB_SHUFFLE_OFF) {
+        if (tracks.empty()) {
+            it = ddb_api->streamer_get_playing_track();
+        } else {
+            it = tracks.back();
+            ddb_api->pl_item_ref(it);
+        }
+    }
+    while (it && (int)tracks.size() < n) {
+        DB_playItem_t* next = ddb_api->pl_get_next(it, PL_MAIN);
+        ddb_api->pl_item_unref(it);
+        it = next;
+        if (it) {
+            ddb_api->pl_item_ref(it);
+            tracks.push_back(it);
+        }
+    }
+    if (it) {
+        ddb_api->pl_item_unref(it);
+    }
+    pl_unlock_traced();
+    return tracks;
+}
+
+void prefetch_cover_art() {
+    int n = ddb_api->conf_get_int(
+        DDB_IPC_PROJECT_ID ".prefetch_cover_art", DDB_IPC_DEFAULT_PREFETCH
+    );
+    if (n <= 0 || !ddb_artwork) {
+        return;
+    }
+    if (ddb_artwork->cancel_queries_with_source_id) {
+        if (prefetch_sid == 0) {
+            prefetch_sid = ddb_artwork->allocate_source_id();
+        } else {
+            // the previous prefetch is stale
+            ddb_artwork->cancel_queries_with_source_id(prefetch_sid);
+        }
+    }
+    auto logger = get_logger();
+    for (DB_playItem_t* track : upcoming_tracks(n)) {
+        if (cached_cover_art(track)) {
+            ddb_api->pl_item_unref(track);
+            continue;
+        }
+        logger->debug("Prefetching cover art.");
+        ddb_cover_query_t* query =
+            (ddb_cover_query_t*)calloc(sizeof(ddb_cover_query_t), 1);
+        query->_size = sizeof(ddb_cover_query_t);
+        query->flags = 0;
+        query->track = track;
+        query->source_id = prefetch_sid;
+        query->user_data = NULL;
+        ddb_artwork->cover_get(query, callback_cover_art_prefetched);
+    }
+}
+
+}  // namespace ddb_ipc
@@ -1,48 +1,128 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
+#include <sys/eventfd.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/un.h>
 #include <unistd.h>
 
-#include <mutex>
-#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
 #include <set>
+#include <sstream>
 #include <string>
-using json = nlohmann::json;
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <deadbeef/deadbeef.h>
 
+#include "arena.hpp"
 #include "argument.hpp"
+#include "capture.hpp"
 #include "commands.hpp"
+#include "cover_art.hpp"
 #include "ddb_ipc.hpp"
+#include "event_log.hpp"
 #include "fmt_optional.hpp"
+#include "format_pool.hpp"
+#include "format_subscription.hpp"
+#include "ipc_json.hpp"
 #include "message.hpp"
+#include "metrics.hpp"
+#include "mpsc_queue.hpp"
+#include "playlist_diff.hpp"
+#include "playqueue.hpp"
 #include "properties.hpp"
+#include "request.hpp"
 #include "response.hpp"
+#include "response_cache.hpp"
+#include "timer_wheel.hpp"
+#include "trace.hpp"
+#include "visualization.hpp"
 
 namespace ddb_ipc {
 
 DB_functions_t* ddb_api;
 ddb_artwork_plugin_t* ddb_artwork;
 
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
 const char configDialog_[] =
     "property \"Socket location\" entry " DDB_IPC_PROJECT_ID
-    ".socketpath \"" DDB_IPC_DEFAULT_SOCKET "\" ;\n";
+    ".socketpath \"" DDB_IPC_DEFAULT_SOCKET "\" ;\n"
+    "property \"Prefetch cover art for N tracks\" entry " DDB_IPC_PROJECT_ID
+    ".prefetch_cover_art \"" XSTR(DDB_IPC_DEFAULT_PREFETCH) "\" ;\n"
+    "property \"Listen backlog\" entry " DDB_IPC_PROJECT_ID
+    ".backlog \"" XSTR(DDB_IPC_DEFAULT_BACKLOG) "\" ;\n"
+    "property \"Capture traffic to file\" file " DDB_IPC_PROJECT_ID
+    ".capture_path \"\" ;\n"
+    "property \"Record trace spans\" checkbox " DDB_IPC_PROJECT_ID
+    ".trace 0 ;\n"
+    "property \"Drop clients idle for N seconds\" entry " DDB_IPC_PROJECT_ID
+    ".idle_timeout \"" XSTR(DDB_IPC_DEFAULT_IDLE_TIMEOUT) "\" ;\n"
+    "property \"Ping clients silent for N seconds\" entry " DDB_IPC_PROJECT_ID
+    ".heartbeat \"" XSTR(DDB_IPC_DEFAULT_HEARTBEAT) "\" ;\n"
+    "property \"Release playlist lock every N items\" entry " DDB_IPC_PROJECT_ID
+    ".lock_chunk_items \"" XSTR(DDB_IPC_DEFAULT_LOCK_CHUNK_ITEMS) "\" ;\n"
+    "property \"Release playlist lock every N microseconds\" entry "
+    DDB_IPC_PROJECT_ID ".lock_chunk_us \"" XSTR(DDB_IPC_DEFAULT_LOCK_CHUNK_US)
+    "\" ;\n"
+    "property \"Title format with N threads (0: one per core)\" entry "
+    DDB_IPC_PROJECT_ID ".format_threads \"0\" ;\n";
 
 DB_plugin_t definition_;
 int ipc_listening = 0;
 int ddb_socket = -1;
 pthread_t ipc_thread;
 char socket_path[PATH_MAX];
-std::recursive_mutex sock_mutex;
+bool socket_adopted = false;
 
 typedef struct pollfd pollfd_t;
 
-pollfd_t fds[DDB_IPC_MAX_CONNECTIONS + 1];
+// slot 0 is the listening socket, slots 1 through DDB_IPC_MAX_CONNECTIONS are
+// clients, and the last slot is wake_fd
+pollfd_t fds[DDB_IPC_MAX_CONNECTIONS + 2];
+// Output buffers, one per slot in fds, reused from response to response so
+// that serializing does not allocate once they have grown. Slot 0 serves
+// sockets that do not occupy a slot, such as refused connections.
+std::string out_buffers[DDB_IPC_MAX_CONNECTIONS + 1];
+// Bytes accepted for a client that it has yet to read, one per slot in fds.
+// Descriptors to pass go with the byte at their offset, and are closed once
+// sent.
+struct Backlog {
+    std::string bytes;
+    size_t written = 0;
+    std::deque<std::pair<size_t, int>> fds;
+};
+Backlog backlogs[DDB_IPC_MAX_CONNECTIONS + 1];
+const int wake_slot = DDB_IPC_MAX_CONNECTIONS + 1;
+int wake_fd = -1;
+std::vector<std::function<void()>> deferred;
+// Work posted by other threads. All socket I/O happens on the IPC thread, so
+// this is the only way for DeaDBeeF's threads to reach a client and posting
+// must never block them.
+MpscQueue<std::function<void()>> posted;
+// set while wake_fd has been written to and run_posted() has yet to run
+std::atomic<bool> wake_pending = false;
+// Connection timers, driven by the IPC thread. Like out_buffers, the timer
+// arrays are indexed by slot in fds and restarted whenever the client sends
+// something.
+TimerWheel timers(std::chrono::milliseconds(DDB_IPC_TIMER_TICK_MS));
+Timer idle_timers[DDB_IPC_MAX_CONNECTIONS + 1];
+Timer heartbeat_timers[DDB_IPC_MAX_CONNECTIONS + 1];
+// armed while a client has a backlog, and restarted whenever it reads some
+Timer write_timers[DDB_IPC_MAX_CONNECTIONS + 1];
+std::chrono::seconds idle_timeout{DDB_IPC_DEFAULT_IDLE_TIMEOUT};
+std::chrono::seconds heartbeat_interval{DDB_IPC_DEFAULT_HEARTBEAT};
 
 std::shared_ptr<spdlog::logger> get_logger() {
     return spdlog::get(DDB_IPC_PROJECT_ID);
@@ -52,7 +132,7 @@ int open_socket(char* socket_path) {
     struct sockaddr_un name;
     size_t size;
     int sock;
-    sock = socket(PF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    sock = socket(PF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
     auto logger = get_logger();
     if (sock < 0) {
@@ -60,19 +140,142 @@ int open_socket(char* socket_path) {
         logger->error("Error creating socket: {}", errno);
         return -1;
     }
+    memset(&name, 0, sizeof(name));
     name.sun_family = PF_LOCAL;
-    strncpy(name.sun_path, socket_path, sizeof(name.sun_path));
-    name.sun_path[sizeof(name.sun_path) - 1] = '\0';
-    size = SUN_LEN(&name);
-    ::unlink(socket_path);
+    if (socket_path[0] == '@') {
+        // abstract namespace: no file system entry to unlink or race on
+        strncpy(name.sun_path + 1, socket_path + 1, sizeof(name.sun_path) - 1);
+        size = offsetof(struct sockaddr_un, sun_path) + 1 +
+               strnlen(name.sun_path + 1, sizeof(name.sun_path) - 1);
+    } else {
+        strncpy(name.sun_path, socket_path, sizeof(name.sun_path));
+        name.sun_path[sizeof(name.sun_path) - 1] = '\0';
+        size = SUN_LEN(&name);
+        ::unlink(socket_path);
+    }
     if (bind(sock, (struct sockaddr*)&name, size) < 0) {
         // TODO: Better error handling here
         logger->error("Error binding socket: {}", errno);
+        ::close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Adopt a listening socket passed by a supervisor using the systemd socket
+// activation protocol, see sd_listen_fds(3). Returns -1 if there is none.
+int adopt_socket() {
+    auto logger = get_logger();
+    const char* pid = getenv("LISTEN_PID");
+    const char* n_fds = getenv("LISTEN_FDS");
+    if (!pid || !n_fds || atol(pid) != getpid()) {
+        return -1;
+    }
+    int n = atoi(n_fds);
+    // prefer a descriptor named after us if the supervisor names them
+    int sock = n > 0 ? DDB_IPC_LISTEN_FDS_START : -1;
+    const char* names = getenv("LISTEN_FDNAMES");
+    if (names) {
+        std::istringstream names_stream(names);
+        std::string name;
+        for (int i = 0; std::getline(names_stream, name, ':') && i < n; i++) {
+            if (name == DDB_IPC_PROJECT_ID) {
+                sock = DDB_IPC_LISTEN_FDS_START + i;
+                break;
+            }
+        }
+    }
+    // the descriptors are meant for us, not for processes we spawn
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    if (sock < 0) {
         return -1;
     }
+    int type = 0, listening = 0;
+    socklen_t len = sizeof(int);
+    if (getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &len) < 0 ||
+        type != SOCK_STREAM ||
+        getsockopt(sock, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 ||
+        !listening)
+    {
+        logger->warn(
+            "Ignoring descriptor {} passed by supervisor: not a listening "
+            "stream socket.",
+            sock
+        );
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    logger->debug("Adopted listening socket with descriptor {}.", sock);
     return sock;
 }
 
+int open_listening_socket() {
+    int sock = adopt_socket();
+    if (sock > -1) {
+        socket_adopted = true;
+        return sock;
+    }
+    socket_adopted = false;
+    auto logger = get_logger();
+    logger->debug("Opening socket at {}.", socket_path);
+    sock = open_socket(socket_path);
+    if (sock < 0) {
+        return -1;
+    }
+    int backlog = ddb_api->conf_get_int(
+        DDB_IPC_PROJECT_ID ".backlog", DDB_IPC_DEFAULT_BACKLOG
+    );
+    if (::listen(sock, backlog) < 0) {
+        logger->error("Error listening on socket: {}", errno);
+        ::close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// A request waiting in the lane of its command's priority
+struct QueuedRequest {
+    Message message;
+    int socket;
+    CommandPriority priority;
+    // order of receipt, across connections
+    uint64_t seq;
+    // registered on receipt, so that deadlines count the time spent waiting
+    // and waiting requests can be cancelled
+    pending_request_t req;
+    std::chrono::steady_clock::time_point received;
+    trace_time_t trace_start;
+};
+// Requests received and not yet dispatched, one lane per priority class. Their
+// documents are allocated in the arena, which is reset only once the lanes
+// have been drained.
+std::deque<QueuedRequest> lanes[DDB_IPC_PRIORITY_CLASSES];
+uint64_t requests_received = 0;
+// The receipt numbers of each connection's queued requests, so that the oldest
+// ones are found without scanning the lanes
+struct QueuedSeqs {
+    std::set<uint64_t> all;
+    std::set<uint64_t> non_bulk;
+};
+std::unordered_map<int, QueuedSeqs> queued_seqs;
+
+void drop_queued_requests(int socket) {
+    for (auto& lane : lanes) {
+        lane.erase(
+            std::remove_if(
+                lane.begin(),
+                lane.end(),
+                [socket](const QueuedRequest& q) { return q.socket == socket; }
+            ),
+            lane.end()
+        );
+    }
+    queued_seqs.erase(socket);
+}
+
 // Send a message to one client
 
 void close_connection(int socket) {
@@ -82,128 +285,449 @@ void close_connection(int socket) {
     for (int i = 0; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
         if (fds[i].fd == socket) {
             fds[i].fd = -1;
+            fds[i].events = POLLIN;
+            std::string().swap(out_buffers[i]);
+            for (auto& [offset, fd] : backlogs[i].fds) {
+                ::close(fd);
+            }
+            backlogs[i] = Backlog();
+            idle_timers[i].cancel();
+            heartbeat_timers[i].cancel();
+            write_timers[i].cancel();
             break;
         }
     }
     observers.erase(socket);
+    drop_visualization_subscriptions(socket);
+    drop_format_subscriptions(socket);
+    capture_disconnected(socket);
+    drop_requests(socket);
+    drop_queued_requests(socket);
+    drop_playlist_subscriptions(socket);
 }
 
-void send_response(json response, int socket) {
-    std::string response_str = response.dump() + std::string("\n");
-    int resp_len = response_str.length();
-    const char* bytes = response_str.c_str();
-    int max_packet_len = DDB_IPC_MAX_PACKET_LENGTH;
-    int packet_len;
-    struct timeval start_time, pkt_time, cur_time;
-    int timeout_ms = DDB_IPC_WRITE_TIMEOUT;
-    int waited_ms;
-    pollfd_t pfd = {.fd = socket, .events = POLLOUT, .revents = 0};
-    gettimeofday(&start_time, NULL);
+ssize_t send_with_fd(int socket, const char* bytes, size_t len, int fd) {
+    struct iovec iov = {.iov_base = (void*)bytes, .iov_len = len};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(socket, &msg, MSG_NOSIGNAL);
+}
+
+// The slot of socket in fds, or 0 if it has none
+int connection_slot(int socket) {
+    for (int i = 1; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
+        if (fds[i].fd == socket) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+std::string& output_buffer(int socket) {
+    return out_buffers[connection_slot(socket)];
+}
+
+bool output_pending(int socket) {
+    int i = connection_slot(socket);
+    return i > 0 && !backlogs[i].bytes.empty();
+}
+
+// Write as much of bytes as socket accepts without blocking, in packets of at
+// most DDB_IPC_MAX_PACKET_LENGTH bytes. If fd is a valid descriptor, it
+// travels with the first of them. Returns the number of bytes written, or -1
+// on error.
+ssize_t write_some(int socket, const char* bytes, size_t len, int fd) {
     size_t i = 0;
+    while (i < len) {
+        size_t packet_len =
+            std::min(len - i, (size_t)DDB_IPC_MAX_PACKET_LENGTH);
+        ssize_t sent;
+        if (fd > -1) {
+            sent = send_with_fd(socket, bytes + i, packet_len, fd);
+        } else {
+            sent = send(socket, bytes + i, packet_len, MSG_NOSIGNAL);
+        }
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        i += sent;
+        fd = -1;
+    }
+    return i;
+}
 
-    auto logger = get_logger();
-    std::lock_guard lock(sock_mutex);
+// Write what the client in slot i accepts of its backlog, and wait for it to
+// become writable if some is left. On failure the connection is closed and
+// false returned.
+bool write_backlog(int i) {
+    Backlog& b = backlogs[i];
+    int socket = fds[i].fd;
+    size_t written = b.written;
+    while (b.written < b.bytes.size()) {
+        // a descriptor must go with the first byte of its message, so a
+        // write stops short of the next one
+        int fd = -1;
+        size_t end = b.bytes.size();
+        auto next_fd = b.fds.begin();
+        if (next_fd != b.fds.end() && next_fd->first == b.written) {
+            fd = next_fd->second;
+            next_fd++;
+        }
+        if (next_fd != b.fds.end()) {
+            end = next_fd->first;
+        }
+        ssize_t sent =
+            write_some(socket, b.bytes.data() + b.written, end - b.written, fd);
+        if (sent < 0) {
+            get_logger()->error(
+                "Error sending on descriptor {}: {}.", socket, errno
+            );
+            close_connection(socket);
+            return false;
+        }
+        if (fd > -1 && sent > 0) {
+            ::close(fd);
+            b.fds.pop_front();
+        }
+        b.written += sent;
+        if (b.written < end) {
+            break;
+        }
+    }
+    bool progressed = b.written != written;
+    if (b.written == b.bytes.size()) {
+        b.bytes.clear();
+        b.written = 0;
+        if (b.bytes.capacity() > DDB_IPC_MAX_RETAINED_BUFFER) {
+            std::string().swap(b.bytes);
+        }
+        fds[i].events = POLLIN;
+        write_timers[i].cancel();
+        return true;
+    }
+    if (b.written >= b.bytes.size() / 2) {
+        // drop what was written, so that the buffer does not keep growing
+        b.bytes.erase(0, b.written);
+        for (auto& [offset, fd] : b.fds) {
+            offset -= b.written;
+        }
+        b.written = 0;
+    }
+    fds[i].events = POLLIN | POLLOUT;
+    if (progressed || !write_timers[i].armed()) {
+        timers.arm(
+            write_timers[i], std::chrono::milliseconds(DDB_IPC_WRITE_TIMEOUT)
+        );
+    }
+    return true;
+}
 
-    request_id req_id{};
-    if (response.contains("request_id") &&
-        response["request_id"].is_number_integer())
-    {
-        req_id = response["request_id"];
-    }
-    while (i < resp_len) {
-        // for (int i = 0; i < resp_len; i += max_packet_len) {
-        // wait for the socket to become available for writing
-        gettimeofday(&pkt_time, NULL);
-        int ret = poll(&pfd, 1, timeout_ms);
-        if (ret == 0) {
+bool send_bytes(
+    int socket, const char* bytes, size_t len, request_id req_id, int fd
+) {
+    auto logger = get_logger();
+    int i = connection_slot(socket);
+    if (i == 0) {
+        // a refused connection gets one try, as it is closed right after
+        send(socket, bytes, len, MSG_NOSIGNAL);
+        return true;
+    }
+    Backlog& b = backlogs[i];
+    if (b.bytes.empty()) {
+        // usually the socket takes it all, and nothing needs to be kept
+        ssize_t sent = write_some(socket, bytes, len, fd);
+        if (sent < 0) {
             logger->error(
                 "Error sending response (request id: {}) on descriptor {}: "
-                "timed out after {} ms.",
+                "{}.",
                 req_id,
                 socket,
-                timeout_ms
+                errno
             );
             close_connection(socket);
-            return;
+            return false;
         }
-        if (ret < 0) {
+        if (sent > 0) {
+            fd = -1;
+        }
+        bytes += sent;
+        len -= sent;
+        if (len == 0) {
+            return true;
+        }
+    }
+    // checked before adding to it, so that one large response always fits
+    if (b.bytes.size() - b.written > DDB_IPC_MAX_OUTPUT_BACKLOG) {
+        logger->warn(
+            "Closing connection with descriptor {}: more than {} bytes not "
+            "read (request id: {}).",
+            socket,
+            DDB_IPC_MAX_OUTPUT_BACKLOG,
+            req_id
+        );
+        close_connection(socket);
+        return false;
+    }
+    if (fd > -1) {
+        // the caller closes fd once this returns
+        int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (copy < 0) {
             logger->error(
-                "Error sending response (request id: {}) on descriptor {}: {}",
+                "Error keeping descriptor for response (request id: {}): {}.",
                 req_id,
-                socket,
                 errno
             );
             close_connection(socket);
-            return;
-        }
-        while (i < resp_len) {
-            packet_len =
-                i + max_packet_len > resp_len ? resp_len - i : max_packet_len;
-            ssize_t sent = send(socket, bytes + i, packet_len, MSG_NOSIGNAL);
-            if (sent < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    break;
-                }
-                logger->error(
-                    "Error sending response (request id: {}) on descriptor {}: "
-                    "{}.",
-                    req_id,
-                    socket,
-                    errno
-                );
-                close_connection(socket);
-                return;
-            } else {
-                i += sent;
-            }
+            return false;
         }
+        b.fds.emplace_back(b.bytes.size(), copy);
+    }
+    b.bytes.append(bytes, len);
+    return write_backlog(i);
+}
+
+// Send the message serialized into out, the output buffer of socket
+void send_serialized(std::string& out, int socket, int fd, request_id req_id) {
+    // without the trailing newline
+    std::string_view logged(out.data(), out.size() - 1);
+    struct timeval start_time, cur_time;
+    int waited_ms;
+    gettimeofday(&start_time, NULL);
+    trace_time_t write_start = tracing() ? trace_now() : -1;
+
+    auto logger = get_logger();
+
+    if (!send_bytes(socket, out.data(), out.size(), req_id, fd)) {
+        return;
+    }
+    // recorded once sent, so that the capture holds what the client got
+    capture_message(socket, '>', logged);
+    if (write_start >= 0) {
+        trace_span("write", write_start, trace_now(), req_id);
     }
     gettimeofday(&cur_time, NULL);
     waited_ms = (cur_time.tv_sec - start_time.tv_sec) * 1000 +
                 (cur_time.tv_usec - start_time.tv_usec) / 1000;
     size_t elision_len = 1024;
-    response_str.erase(response_str.end() - 1);
-    if (resp_len > elision_len + 20) {
+    if (logged.size() > elision_len + 20) {
         logger->debug(
             "Responded (request id: {}): {} [..., {} characters omitted] {} in "
             "{} ms.",
             req_id,
-            response_str.substr(0, elision_len / 2),
-            resp_len - elision_len,
-            response_str.substr(resp_len - elision_len / 2, elision_len / 2),
+            logged.substr(0, elision_len / 2),
+            logged.size() - elision_len,
+            logged.substr(logged.size() - elision_len / 2),
             waited_ms
         );
     } else {
         logger->debug(
             "Responded (request id: {}): {} in {} ms.",
             req_id,
-            response_str,
+            logged,
             waited_ms
         );
     }
+    if (out.capacity() > DDB_IPC_MAX_RETAINED_BUFFER) {
+        // do not hold on to the memory of an exceptionally large response
+        std::string().swap(out);
+    }
+}
+
+void send_response(const json& response, int socket, int fd) {
+    std::string& out = output_buffer(socket);
+    serialize_message(response, out);
+    request_id req_id{};
+    auto id = response.find("request_id");
+    if (id != response.end() && id->is_number_integer()) {
+        req_id = id->get<int>();
+    }
+    send_serialized(out, socket, fd, req_id);
 }
 
 // Send a message to all connected clients
 
+bool on_ipc_thread() {
+    return ipc_listening && pthread_equal(pthread_self(), ipc_thread);
+}
+
 void broadcast(json message) {
+    if (!ipc_listening) {
+        return;
+    }
+    if (!on_ipc_thread()) {
+        post([message = std::move(message)]() mutable {
+            broadcast(std::move(message));
+        });
+        return;
+    }
     auto logger = get_logger();
-    std::string message_str = message.dump();
-    logger->debug("Broadcasting: {}.", message_str);
-    message_str += "\n";
-    std::lock_guard lock(sock_mutex);
+    static std::string out;
+    // events are numbered on the thread that sends them, so the numbers are
+    // in the order clients receive them
+    log_event(message);
+    serialize_message(message, out);
+    // without the trailing newline
+    std::string_view line(out.data(), out.size() - 1);
+    logger->debug("Broadcasting: {}.", line);
     for (int i = 1; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
-        if (fds[i].fd > -1) {
-            send(
-                fds[i].fd, message_str.c_str(), message_str.size(), MSG_NOSIGNAL
-            );
+        int socket = fds[i].fd;
+        if (socket > -1 && send_bytes(socket, out.data(), out.size(), {})) {
+            capture_message(socket, '>', line);
         }
     }
 }
 
-void handle_message(Message m, int socket) {
+void enqueue_request(Message m, int socket) {
+    QueuedRequest q;
+    q.socket = socket;
+    q.priority = command_priority(m.command);
+    q.seq = requests_received++;
+    q.req = register_request(socket, m);
+    q.received = std::chrono::steady_clock::now();
+    q.trace_start = tracing() ? trace_now() : -1;
+    q.message = std::move(m);
+    auto& seqs = queued_seqs[socket];
+    seqs.all.insert(q.seq);
+    if (q.priority != DDB_IPC_PRIORITY_BULK) {
+        seqs.non_bulk.insert(q.seq);
+    }
+    lanes[q.priority].push_back(std::move(q));
+}
+
+bool lanes_empty() {
+    for (auto& lane : lanes) {
+        if (!lane.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Requests on a connection are dispatched in the order they were received,
+// except that bulk requests, which only read, may be overtaken by later ones:
+// a bulk request waits for all earlier requests, any other only for earlier
+// requests that are not bulk.
+bool dispatchable(const QueuedRequest& q) {
+    auto& seqs = queued_seqs.at(q.socket);
+    auto& earlier =
+        q.priority == DDB_IPC_PRIORITY_BULK ? seqs.all : seqs.non_bulk;
+    return *earlier.begin() == q.seq;
+}
+
+void dequeued(const QueuedRequest& q) {
+    auto it = queued_seqs.find(q.socket);
+    it->second.all.erase(q.seq);
+    it->second.non_bulk.erase(q.seq);
+    if (it->second.all.empty()) {
+        queued_seqs.erase(it);
+    }
+}
+
+// Take the oldest dispatchable request of the highest priority lane that has
+// one. The oldest request of each connection is always dispatchable.
+bool next_request(QueuedRequest& next) {
+    for (auto& lane : lanes) {
+        for (auto it = lane.begin(); it != lane.end(); it++) {
+            if (dispatchable(*it)) {
+                dequeued(*it);
+                next = std::move(*it);
+                lane.erase(it);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void handle_request(QueuedRequest& q) {
+    Message& m = q.message;
+    int socket = q.socket;
+    pending_request_t& req = q.req;
     json response;
-    response = call_command(m.command, m.id, m.args);
-    send_response(response, socket);
+    set_trace_request(m.id);
+    CacheLookup lookup = cache_lookup(m.command, m.args);
+    std::string& out = output_buffer(socket);
+    bool cached = false;
+    if (req && req->interrupted()) {
+        response = interrupted_response(req);
+    } else if (cached_response(lookup, m.id, out)) {
+        cached = true;
+    } else {
+        set_current_request(req);
+        response = call_command(m.command, m.id, m.args);
+        set_current_request(nullptr);
+        cache_response(lookup, response);
+    }
+    if (req && !req->asynchronous) {
+        release_request(req);
+    }
+    if (cached) {
+        send_serialized(out, socket, -1, m.id);
+    } else if (!response.is_null()) {
+        // null if the command has streamed its response itself
+        send_response(response, socket);
+    }
+    record_request_latency(
+        q.priority, std::chrono::steady_clock::now() - q.received
+    );
+    if (q.trace_start >= 0) {
+        trace_span("request", q.trace_start, trace_now(), m.id);
+    }
+    set_trace_request(std::nullopt);
+}
+
+void defer(std::function<void()> f) { deferred.push_back(f); }
+
+void run_deferred() {
+    for (auto& f : deferred) {
+        f();
+    }
+    deferred.clear();
+}
+
+void wake() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        get_logger()->error("Error waking up IPC thread: {}.", errno);
+    }
+}
+
+void post(std::function<void()> f) {
+    posted.push(std::move(f));
+    // one write to wake_fd until the IPC thread has caught up is enough
+    if (!wake_pending.exchange(true)) {
+        wake();
+    }
+}
+
+void run_posted() {
+    uint64_t count;
+    while (read(wake_fd, &count, sizeof(count)) > 0) {
+    }
+    // cleared before popping: a push we miss wakes us again
+    wake_pending = false;
+    std::function<void()> f;
+    while (posted.pop(f)) {
+        f();
+    }
+    // release what the last task captured
+    f = nullptr;
 }
 
 void handle_message(json message, int socket) {
@@ -220,9 +744,10 @@ void handle_message(json message, int socket) {
                 ),
                 socket
             );
+            return;
         }
         m.args["socket"] = socket;
-        handle_message(m, socket);
+        enqueue_request(std::move(m), socket);
     } catch (Exception& e) {
         logger->debug("Invalid message {}: {}.", message.dump(), e.what());
     } catch (std::exception& e) {
@@ -232,14 +757,44 @@ void handle_message(json message, int socket) {
     }
 }
 
+void handle_line(const std::string& l, int fd) {
+    auto logger = get_logger();
+    trace_time_t parse_start = tracing() ? trace_now() : -1;
+    json message;
+    try {
+        message = json::parse(l);
+    } catch (const json::exception& e) {
+        logger->warn("Message is not valid JSON: {}.", e.what());
+        send_response(
+            json{
+                {"status", DDB_IPC_RESPONSE_ERR},
+                {"response",
+                 std::string("Message is not valid JSON: ") + e.what()}
+            },
+            fd
+        );
+        return;
+    }
+    if (parse_start >= 0) {
+        auto id = message.find("request_id");
+        trace_span(
+            "parse",
+            parse_start,
+            trace_now(),
+            id != message.end() && id->is_number_integer()
+                ? request_id(id->get<int>())
+                : std::nullopt
+        );
+    }
+    handle_message(message, fd);
+}
+
 int read_messages(int fd) {
     // return value: 0 if no errors occured and the connection should be kept
     // open -1 otherwise
     int should_close_conn = 0;
     char buf[DDB_IPC_MAX_PACKET_LENGTH];
     int rc;
-    json message;
-    std::lock_guard lock(sock_mutex);
 
     auto logger = get_logger();
     do {
@@ -259,26 +814,137 @@ int read_messages(int fd) {
         std::istringstream msg(buf);
         std::string l;
         while (std::getline(msg, l)) {
-            try {
-                message = json::parse(l);
-            } catch (const json::exception& e) {
-                logger->warn("Message is not valid JSON: {}.", e.what());
-                send_response(
-                    json{
-                        {"status", DDB_IPC_RESPONSE_ERR},
-                        {"response",
-                         std::string("Message is not valid JSON: ") + e.what()}
-                    },
-                    fd
-                );
-                continue;
-            }
-            handle_message(message, fd);
+            capture_message(fd, '<', l);
+            handle_line(l, fd);
         }
     } while (1);
     return should_close_conn;
 }
 
+// The earlier of two poll timeouts, -1 meaning none
+int earlier_timeout(int a, int b) {
+    if (a < 0 || b < 0) {
+        return std::max(a, b);
+    }
+    return std::min(a, b);
+}
+
+// Restart the timers of the client in slot i, which has just been heard from
+void touch_connection(int i) {
+    if (idle_timeout.count() > 0) {
+        timers.arm(idle_timers[i], idle_timeout);
+    } else {
+        idle_timers[i].cancel();
+    }
+    if (heartbeat_interval.count() > 0) {
+        timers.arm(heartbeat_timers[i], heartbeat_interval);
+    } else {
+        heartbeat_timers[i].cancel();
+    }
+}
+
+void init_connection_timers() {
+    for (int i = 1; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
+        idle_timers[i].callback = [i]() {
+            get_logger()->info(
+                "Closing connection with descriptor {}: idle for {} s.",
+                fds[i].fd,
+                idle_timeout.count()
+            );
+            close_connection(fds[i].fd);
+        };
+        heartbeat_timers[i].callback = [i]() {
+            // armed first, as a failed send closes the connection and
+            // cancels the timer
+            timers.arm(heartbeat_timers[i], heartbeat_interval);
+            send_response(json{{"event", "ping"}}, fds[i].fd);
+        };
+        write_timers[i].callback = [i]() {
+            get_logger()->warn(
+                "Closing connection with descriptor {}: nothing read for {} "
+                "ms.",
+                fds[i].fd,
+                DDB_IPC_WRITE_TIMEOUT
+            );
+            close_connection(fds[i].fd);
+        };
+    }
+}
+
+// Read the timeouts from the configuration, and apply them to the connected
+// clients if they changed
+void update_connection_timers() {
+    std::chrono::seconds idle{std::max(
+        0,
+        ddb_api->conf_get_int(
+            DDB_IPC_PROJECT_ID ".idle_timeout", DDB_IPC_DEFAULT_IDLE_TIMEOUT
+        )
+    )};
+    std::chrono::seconds heartbeat{std::max(
+        0,
+        ddb_api->conf_get_int(
+            DDB_IPC_PROJECT_ID ".heartbeat", DDB_IPC_DEFAULT_HEARTBEAT
+        )
+    )};
+    if (idle == idle_timeout && heartbeat == heartbeat_interval) {
+        return;
+    }
+    idle_timeout = idle;
+    heartbeat_interval = heartbeat;
+    for (int i = 1; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
+        if (fds[i].fd > -1) {
+            touch_connection(i);
+        }
+    }
+}
+
+// Write the backlogs of the clients that poll() found writable
+void write_backlogs() {
+    for (int i = 1; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
+        if (fds[i].fd > -1 && fds[i].revents & (POLLOUT | POLLERR)) {
+            write_backlog(i);
+        }
+    }
+}
+
+// Read the requests of the clients that poll() found readable into the lanes
+void read_requests() {
+    for (int i = 1; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
+        // the slot may have been closed since poll() returned
+        if (fds[i].fd > -1 && fds[i].revents & POLLIN) {
+            touch_connection(i);
+            if (read_messages(fds[i].fd) < 0) {
+                close_connection(fds[i].fd);
+            }
+        }
+    }
+}
+
+// Dispatch the waiting requests, highest priority first. Requests that
+// arrive meanwhile are read in between, so that they can overtake those
+// still waiting; a command that is running is never interrupted. Reading
+// stops once the arena holds DDB_IPC_MAX_ARENA_BACKLOG bytes, so that a
+// steady stream of requests cannot keep it from being reset: the lanes are
+// then drained, and the rest is read on the next round.
+void dispatch_requests() {
+    QueuedRequest q;
+    while (next_request(q)) {
+        handle_request(q);
+        q = QueuedRequest();
+        {
+            // deferred work may keep JSON around, so it runs on the heap
+            HeapScope heap;
+            run_deferred();
+        }
+        if (!lanes_empty() && arena_size() < DDB_IPC_MAX_ARENA_BACKLOG &&
+            poll(fds + 1, DDB_IPC_MAX_CONNECTIONS, 0) > 0)
+        {
+            write_backlogs();
+            read_requests();
+        }
+    }
+}
+
 int accept_connection(int new_conn, pollfd_t* fds, int n_fds) {
     // try to find an open slot, return 0 if success, -1 otherwise
     auto logger = get_logger();
@@ -288,13 +954,15 @@ int accept_connection(int new_conn, pollfd_t* fds, int n_fds) {
             logger->debug(
                 "Accepted new connection with descriptor {}.", new_conn
             );
+            capture_connected(new_conn);
+            touch_connection(i);
             return 0;
         }
     }
     return -1;
 }
 
-void* listen(void* sockname) {
+void* listen(void*) {
     int i;
     int rc;
     int new_conn;
@@ -305,20 +973,35 @@ void* listen(void* sockname) {
         memcpy(&fds[i], &open_slot, sizeof(pollfd_t));
     }
 
-    ddb_socket = open_socket((char*)sockname);
-    rc = ::listen(ddb_socket, 1);
     fds[0].fd = ddb_socket;
+    fds[wake_slot].fd = wake_fd;
+    fds[wake_slot].events = POLLIN;
+    init_connection_timers();
+    update_connection_timers();
 
     auto logger = get_logger();
     while (ipc_listening) {
-        rc = poll(fds, DDB_IPC_MAX_CONNECTIONS + 1, DDB_IPC_POLL_FREQ);
+        // sleep until there is I/O, work posted by another thread, a
+        // request deadline to enforce, a visualization frame to send, or a
+        // connection timer to run
+        int timeout = earlier_timeout(
+            earlier_timeout(next_deadline_ms(), next_frame_ms()),
+            timers.next_timeout_ms()
+        );
+        rc = poll(fds, DDB_IPC_MAX_CONNECTIONS + 2, timeout);
         if (rc < 0) {
             logger->error("Error reading from socket: {}.", errno);
         }
+        expire_requests();
+        send_visualization_frames();
+        timers.advance();
         if (rc == 0) {
             // timed out
             continue;
         }
+        if (fds[wake_slot].revents & POLLIN) {
+            run_posted();
+        }
         if (fds[0].revents & POLLIN) {
             // TODO refactor this into its own function
             // there are incoming connections
@@ -338,20 +1021,34 @@ void* listen(void* sockname) {
                 logger->warn("accept() failed");
             }
         }
-        for (i = 1; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
-            if (fds[i].revents & POLLIN) {
-                if (read_messages(fds[i].fd) < 0) {
-                    close_connection(fds[i].fd);
-                }
-            }
+        write_backlogs();
+        {
+            // the request and response documents are allocated in the
+            // arena, which is reset once all the requests read have been
+            // answered
+            ArenaScope scope;
+            read_requests();
+            dispatch_requests();
         }
     }
     for (i = 0; i <= DDB_IPC_MAX_CONNECTIONS; i++) {
         if (fds[i].fd > -1) {
             ::close(fds[i].fd);
+            drop_playlist_subscriptions(fds[i].fd);
+            drop_visualization_subscriptions(fds[i].fd);
+            drop_format_subscriptions(fds[i].fd);
+            for (auto& [offset, fd] : backlogs[i].fds) {
+                ::close(fd);
+            }
+            backlogs[i] = Backlog();
+            idle_timers[i].cancel();
+            heartbeat_timers[i].cancel();
+            write_timers[i].cancel();
         }
     }
     observers.clear();
+    stop_capture();
+    stop_format_pool();
     return 0;
 }
 
@@ -359,12 +1056,21 @@ int start() { return 0; }
 
 int stop() {
     auto logger = get_logger();
+    if (!ipc_listening) {
+        return 0;
+    }
     logger->debug("Stopping polling thread...");
     ipc_listening = 0;
+    wake();
     pthread_join(ipc_thread, NULL);
     logger->debug("Closing socket....");
     ::close(ddb_socket);
-    ::unlink(socket_path);
+    ::close(wake_fd);
+    // an adopted socket belongs to the supervisor, and abstract sockets have
+    // no file system entry
+    if (!socket_adopted && socket_path[0] != '@') {
+        ::unlink(socket_path);
+    }
     return 0;
 }
 
@@ -372,10 +1078,14 @@ int disconnect() { return 0; }
 
 int connect() {
     ddb_artwork = (ddb_artwork_plugin_t*)ddb_api->plug_get_for_id("artwork2");
+    update_capture();
+    update_tracing();
     return 0;
 }
 
-// Handle events sent to us by DeaDBeeF
+// Handle events sent to us by DeaDBeeF. These run on DeaDBeeF's message
+// thread and must not block it, so anything that talks to clients or may wait
+// on I/O is handed to the IPC thread.
 
 void on_toggle_pause(int p) {
     if (p) {
@@ -385,7 +1095,11 @@ void on_toggle_pause(int p) {
     }
 }
 
-void on_track_changed() { broadcast(json{{"event", "track-changed"}}); }
+void on_track_changed() {
+    broadcast(json{{"event", "track-changed"}});
+    on_format_inputs_changed();
+    post(prefetch_cover_art);
+}
 
 void on_seek(ddb_event_playpos_t* ctx) {
     float dur = ddb_api->pl_get_item_duration(ctx->track);
@@ -416,23 +1130,11 @@ void on_config_changed() {
     auto logger = get_logger();
     logger->debug("Config changed...");
     broadcast(json{{"event", "config-changed"}});
-    json resp;
-    for (auto obs = observers.begin(); obs != observers.end(); obs++) {
-        logger->debug("Handling observer #{}.", obs->first);
-        auto propset = obs->second;
-        for (auto prop = propset.begin(); prop != propset.end(); prop++) {
-            resp = json{{"event", "property-change"}, {"property", *prop}};
-            if (getters.count(*prop)) {
-                resp["value"] = getters[*prop]();
-            } else {
-                resp["value"] = property_as_json(*prop);
-            }
-            logger->debug(
-                "Property {}; value {}.", *prop, resp["value"].dump()
-            );
-            send_response(resp, obs->first);
-        }
-    }
+    notify_property_observers();
+    // opens or closes the capture file
+    post(update_capture);
+    post(update_connection_timers);
+    update_tracing();
 }
 
 void on_playlist_switched() {
@@ -444,12 +1146,18 @@ void on_playlist_switched() {
 }
 
 int handleMessage(uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    invalidate_cached_responses(id);
     switch (id) {
         case DB_EV_PAUSED:
             on_toggle_pause(p1);
+            on_format_inputs_changed();
             break;
         case DB_EV_SEEKED:
             on_seek((ddb_event_playpos_t*)ctx);
+            on_format_inputs_changed();
+            break;
+        case DB_EV_TRACKINFOCHANGED:
+            on_format_inputs_changed();
             break;
         case DB_EV_SONGCHANGED:
             on_track_changed();
@@ -462,6 +1170,16 @@ int handleMessage(uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
             break;
         case DB_EV_PLAYLISTSWITCHED:
             on_playlist_switched();
+            break;
+        case DB_EV_PLAYLISTCHANGED:
+            if (p1 == DDB_PLAYLIST_CHANGE_CONTENT ||
+                p1 == DDB_PLAYLIST_CHANGE_DELETED)
+            {
+                on_playlist_content_changed();
+            } else if (p1 == DDB_PLAYLIST_CHANGE_PLAYQUEUE) {
+                on_playqueue_changed();
+            }
+            break;
     }
     return 0;
 }
@@ -500,10 +1218,21 @@ DB_plugin_t* load(DB_functions_t* api) {
         socket_path,
         PATH_MAX
     );
-    auto logger = get_logger();
-    logger->debug("Opening socket at {}.", socket_path);
+    // listen before returning, so that clients can connect while the rest
+    // of the player is loading
+    ddb_socket = open_listening_socket();
+    if (ddb_socket < 0) {
+        get_logger()->error("Failed to open socket, IPC is disabled.");
+        return &definition_;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        get_logger()->error("Failed to create eventfd, IPC is disabled.");
+        ::close(ddb_socket);
+        return &definition_;
+    }
     ipc_listening = 1;
-    pthread_create(&ipc_thread, NULL, listen, (void*)socket_path);
+    pthread_create(&ipc_thread, NULL, listen, NULL);
     return &definition_;
 }
 
@@ -0,0 +1,71 @@
+#include "event_log.hpp"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+#include "arena.hpp"
+#include "ddb_ipc.hpp"
+#include "response.hpp"
+
+namespace ddb_ipc {
+
+// Sequence numbers start from the time the plugin was loaded, in
+// microseconds, so that a client resuming with a number handed out before a
+// restart is always behind the log and told to resync.
+int64_t initial_seq() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch()
+    )
+        .count();
+}
+
+std::mutex event_log_mutex;
+// the sequence number of the latest event
+int64_t event_seq = initial_seq();
+// the latest events, oldest first
+std::deque<json> event_log;
+
+void log_event(json& event) {
+    std::lock_guard lock(event_log_mutex);
+    event["seq"] = ++event_seq;
+    // the copy outlives any request being handled
+    HeapScope heap;
+    event_log.push_back(event);
+    if (event_log.size() > DDB_IPC_EVENT_LOG_SIZE) {
+        event_log.pop_front();
+    }
+}
+
+class ResumeArgument : Argument {
+  public:
+    int64_t since;
+};
+DDB_IPC_DEFINE_TYPE(ResumeArgument, since);
+COMMAND(resume, ResumeArgument) {
+    json events = json::array();
+    bool resync;
+    int64_t seq;
+    {
+        std::lock_guard lock(event_log_mutex);
+        seq = event_seq;
+        // the sequence number of the oldest event still in the log
+        int64_t oldest = seq - (int64_t)event_log.size() + 1;
+        resync = args.since < oldest - 1 || args.since > seq;
+        if (!resync) {
+            for (auto it = event_log.end() - (seq - args.since);
+                 it != event_log.end();
+                 it++)
+            {
+                events.push_back(*it);
+            }
+        }
+    }
+    json resp = ok_response(id);
+    resp["resync"] = resync;
+    resp["seq"] = seq;
+    resp["events"] = events;
+    return resp;
+}
+
+}  // namespace ddb_ipc
@@ -0,0 +1,142 @@
+#include "format_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ddb_ipc.hpp"
+
+namespace ddb_ipc {
+
+// items claimed at a time, few enough to balance the threads' loads
+const size_t format_block = 64;
+
+struct FormatJob {
+    char* code;
+    DB_playItem_t* const* items;
+    size_t n;
+    int iter;
+    std::string* results;
+    std::atomic<size_t> next = 0;
+};
+
+std::vector<std::thread> format_workers;
+std::mutex pool_mutex;
+std::condition_variable work_cv;
+std::condition_variable done_cv;
+// the job being worked on, and a count of the jobs so that workers take
+// part in each once
+FormatJob* current_job = nullptr;
+uint64_t jobs_posted = 0;
+// workers taking part in the current job
+int busy_workers = 0;
+bool stopping = false;
+
+void format_blocks(FormatJob& job, char* buf, size_t buf_len) {
+    size_t i;
+    while ((i = job.next.fetch_add(format_block)) < job.n) {
+        size_t end = std::min(job.n, i + format_block);
+        for (; i < end; i++) {
+            ddb_tf_context_t ctx = {
+                ._size = sizeof(ddb_tf_context_t),
+                .flags = 0,
+                .it = job.items[i],
+                .plt = NULL,
+                .idx = 0,
+                .id = 0,
+                .iter = job.iter,
+            };
+            ddb_api->tf_eval(&ctx, job.code, buf, buf_len);
+            job.results[i].assign(buf);
+        }
+    }
+}
+
+void format_worker() {
+    char buf[4096];
+    uint64_t seen = 0;
+    std::unique_lock lock(pool_mutex);
+    while (true) {
+        work_cv.wait(lock, [&]() { return stopping || jobs_posted != seen; });
+        if (stopping) {
+            return;
+        }
+        seen = jobs_posted;
+        // the job may be over by the time this worker wakes up
+        FormatJob* job = current_job;
+        if (!job) {
+            continue;
+        }
+        busy_workers++;
+        lock.unlock();
+        format_blocks(*job, buf, sizeof(buf));
+        lock.lock();
+        if (--busy_workers == 0) {
+            done_cv.notify_one();
+        }
+    }
+}
+
+void stop_format_pool() {
+    {
+        std::lock_guard lock(pool_mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& t : format_workers) {
+        t.join();
+    }
+    format_workers.clear();
+    stopping = false;
+}
+
+int format_threads() {
+    int n = ddb_api->conf_get_int(DDB_IPC_PROJECT_ID ".format_threads", 0);
+    if (n <= 0) {
+        n = std::thread::hardware_concurrency();
+    }
+    return std::clamp(n, 1, DDB_IPC_MAX_FORMAT_THREADS);
+}
+
+void format_items(
+    char* code,
+    DB_playItem_t* const* items,
+    size_t n,
+    int iter,
+    std::string* results
+) {
+    char buf[4096];
+    FormatJob job;
+    job.code = code;
+    job.items = items;
+    job.n = n;
+    job.iter = iter;
+    job.results = results;
+    // handing a small batch to other threads costs more than it saves
+    if (n < DDB_IPC_PARALLEL_FORMAT_MIN) {
+        format_blocks(job, buf, sizeof(buf));
+        return;
+    }
+    size_t workers = format_threads() - 1;
+    if (format_workers.size() != workers) {
+        stop_format_pool();
+        for (size_t i = 0; i < workers; i++) {
+            format_workers.emplace_back(format_worker);
+        }
+    }
+    {
+        std::lock_guard lock(pool_mutex);
+        current_job = &job;
+        jobs_posted++;
+    }
+    work_cv.notify_all();
+    format_blocks(job, buf, sizeof(buf));
+    std::unique_lock lock(pool_mutex);
+    done_cv.wait(lock, []() { return busy_workers == 0; });
+    current_job = nullptr;
+}
+
+}  // namespace ddb_ipc
@@ -0,0 +1,204 @@
+#include "format_subscription.hpp"
+
+#include <deadbeef/deadbeef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ddb_ipc.hpp"
+#include "response.hpp"
+#include "trace.hpp"
+
+namespace ddb_ipc {
+
+// A title format a client is subscribed to, compiled once, with the output
+// last sent to it; nullopt when nothing is playing
+class FormatSubscription {
+  public:
+    int socket;
+    std::string format;
+    char* code = nullptr;
+    std::optional<std::string> last;
+    // re-evaluates the format periodically, for formats that change as the
+    // track plays
+    Timer tick;
+    std::chrono::milliseconds interval{0};
+
+    ~FormatSubscription() {
+        if (code) {
+            ddb_api->tf_free(code);
+        }
+    }
+};
+
+// only accessed on the IPC thread; a list, as the timers must stay put
+std::list<FormatSubscription> format_subscriptions;
+std::atomic<bool> formats_pending = false;
+
+std::optional<std::string> evaluate_format(
+    const FormatSubscription& s, DB_playItem_t* cur
+) {
+    if (!cur) {
+        return std::nullopt;
+    }
+    ddb_tf_context_t ctx = {
+        ._size = sizeof(ddb_tf_context_t),
+        .flags = 0,
+        .it = cur,
+        .plt = NULL,
+        .idx = 0,
+        .id = 0,
+        .iter = PL_MAIN,
+    };
+    char buf[4096] = "";
+    TraceSpan span("tf");
+    ddb_api->tf_eval(&ctx, s.code, buf, sizeof(buf));
+    return std::string(buf);
+}
+
+// The event to send if the output of the format changed, null otherwise
+json format_changed_event(FormatSubscription& s, DB_playItem_t* cur) {
+    std::optional<std::string> value = evaluate_format(s, cur);
+    if (value == s.last) {
+        return nullptr;
+    }
+    s.last = std::move(value);
+    return json{
+        {"event", "format-changed"},
+        {"format", s.format},
+        {"value", s.last ? json(s.last.value()) : json(nullptr)},
+    };
+}
+
+void update_format_subscriptions() {
+    formats_pending = false;
+    if (format_subscriptions.empty()) {
+        return;
+    }
+    // sent once all are evaluated, as a failed send drops the subscriptions
+    // of its connection
+    std::vector<std::pair<int, json>> events;
+    DB_playItem_t* cur = ddb_api->streamer_get_playing_track();
+    for (auto& s : format_subscriptions) {
+        json event = format_changed_event(s, cur);
+        if (!event.is_null()) {
+            events.emplace_back(s.socket, std::move(event));
+        }
+    }
+    if (cur) {
+        ddb_api->pl_item_unref(cur);
+    }
+    for (auto& [socket, event] : events) {
+        send_response(event, socket);
+    }
+}
+
+void on_format_inputs_changed() {
+    if (!formats_pending.exchange(true)) {
+        post(update_format_subscriptions);
+    }
+}
+
+void drop_format_subscriptions(int socket) {
+    format_subscriptions.remove_if([socket](const FormatSubscription& s) {
+        return s.socket == socket;
+    });
+}
+
+void start_ticking(FormatSubscription& s) {
+    if (s.interval.count() == 0) {
+        s.tick.cancel();
+        return;
+    }
+    s.tick.callback = [&s]() {
+        timers.arm(s.tick, s.interval);
+        DB_playItem_t* cur = ddb_api->streamer_get_playing_track();
+        json event = format_changed_event(s, cur);
+        if (cur) {
+            ddb_api->pl_item_unref(cur);
+        }
+        // a failed send drops the subscription, and with it this callback
+        if (!event.is_null()) {
+            post([socket = s.socket, event = std::move(event)]() {
+                send_response(event, socket);
+            });
+        }
+    };
+    timers.arm(s.tick, s.interval);
+}
+
+class SubscribeFormatArgument : Argument {
+  public:
+    std::string format = DDB_IPC_DEFAULT_FORMAT;
+    int interval_ms = 0;
+    int socket;
+};
+DDB_IPC_DEFINE_TYPE_WITH_DEFAULT(
+    SubscribeFormatArgument, format, interval_ms, socket
+);
+COMMAND(subscribe_format, SubscribeFormatArgument) {
+    if (args.interval_ms != 0 && args.interval_ms < DDB_IPC_TIMER_TICK_MS) {
+        return bad_request_response(
+            id,
+            "Argument interval_ms must be 0 or at least " +
+                std::to_string(DDB_IPC_TIMER_TICK_MS) + "."
+        );
+    }
+    auto it = std::find_if(
+        format_subscriptions.begin(),
+        format_subscriptions.end(),
+        [&](const FormatSubscription& s) {
+            return s.socket == args.socket && s.format == args.format;
+        }
+    );
+    if (it == format_subscriptions.end()) {
+        char* code = ddb_api->tf_compile(args.format.c_str());
+        if (code == NULL) {
+            return error_response(id, "Compilation of title format failed.");
+        }
+        it = format_subscriptions.emplace(format_subscriptions.end());
+        it->socket = args.socket;
+        it->format = args.format;
+        it->code = code;
+    }
+    // subscribing again changes the interval
+    it->interval = std::chrono::milliseconds(args.interval_ms);
+    start_ticking(*it);
+    DB_playItem_t* cur = ddb_api->streamer_get_playing_track();
+    it->last = evaluate_format(*it, cur);
+    if (cur) {
+        ddb_api->pl_item_unref(cur);
+    }
+    json resp = ok_response(id);
+    resp["value"] = it->last ? json(it->last.value()) : json(nullptr);
+    return resp;
+}
+
+class UnsubscribeFormatArgument : Argument {
+  public:
+    std::string format = DDB_IPC_DEFAULT_FORMAT;
+    int socket;
+};
+DDB_IPC_DEFINE_TYPE_WITH_DEFAULT(UnsubscribeFormatArgument, format, socket);
+COMMAND(unsubscribe_format, UnsubscribeFormatArgument) {
+    auto it = std::find_if(
+        format_subscriptions.begin(),
+        format_subscriptions.end(),
+        [&](const FormatSubscription& s) {
+            return s.socket == args.socket && s.format == args.format;
+        }
+    );
+    if (it == format_subscriptions.end()) {
+        return error_response(id, "Not subscribed to format.");
+    }
+    format_subscriptions.erase(it);
+    return ok_response(id);
+}
+
+}  // namespace ddb_ipc
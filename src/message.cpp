@@ -27,8 +27,15 @@ void from_json(const json &j, Message &m) {
     if (j.contains("request_id") && j["request_id"].is_number_integer()) {
         id = j["request_id"];
     }
+    std::optional<int> deadline_ms{};
+    if (j.contains("deadline_ms")) {
+        if (!j["deadline_ms"].is_number_integer()) {
+            throw Exception("`deadline_ms` field must be an integer.");
+        }
+        deadline_ms = j["deadline_ms"];
+    }
     json args = j.contains("args") ? j["args"] : json{};
-    m = Message(id, command, args);
+    m = Message(id, command, args, deadline_ms);
 }
 
 }  // namespace ddb_ipc
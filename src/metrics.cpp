@@ -0,0 +1,109 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ddb_ipc.hpp"
+#include "response.hpp"
+
+namespace ddb_ipc {
+
+const char* priority_names[DDB_IPC_PRIORITY_CLASSES] = {
+    "interactive",
+    "normal",
+    "bulk",
+};
+LatencyHistogram request_latency[DDB_IPC_PRIORITY_CLASSES];
+LatencyHistogram pl_lock_hold;
+
+void LatencyHistogram::record(std::chrono::nanoseconds d) {
+    int64_t ns = d.count();
+    int k = 0;
+    if (ns >= 1000) {
+        k = 1 + (int)std::floor(4 * std::log2(ns / 1000.0));
+        k = std::min(k, DDB_IPC_LATENCY_BUCKETS - 1);
+    }
+    buckets[k].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    int64_t max = max_ns.load(std::memory_order_relaxed);
+    while (ns > max &&
+           !max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (auto& b : buckets) {
+        b.store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
+
+json LatencyHistogram::summary() const {
+    // a snapshot of the buckets; records racing with it may be missed
+    uint64_t counts[DDB_IPC_LATENCY_BUCKETS];
+    uint64_t total = 0;
+    for (int k = 0; k < DDB_IPC_LATENCY_BUCKETS; k++) {
+        counts[k] = buckets[k].load(std::memory_order_relaxed);
+        total += counts[k];
+    }
+    double max_us = max_ns.load(std::memory_order_relaxed) / 1000.0;
+    // the upper bound of the bucket the percentile falls in, or the maximum
+    // if that is lower
+    auto percentile = [&](double q) -> double {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, std::ceil(q * total));
+        uint64_t seen = 0;
+        for (int k = 0; k < DDB_IPC_LATENCY_BUCKETS; k++) {
+            seen += counts[k];
+            if (seen >= rank) {
+                return std::min(std::exp2(k / 4.0), max_us);
+            }
+        }
+        return max_us;
+    };
+    return json{
+        {"count", total},
+        {"p50_us", percentile(0.5)},
+        {"p90_us", percentile(0.9)},
+        {"p99_us", percentile(0.99)},
+        {"max_us", max_us},
+    };
+}
+
+void record_request_latency(
+    CommandPriority priority, std::chrono::nanoseconds d
+) {
+    request_latency[priority].record(d);
+}
+
+void record_pl_lock_hold(std::chrono::nanoseconds d) {
+    pl_lock_hold.record(d);
+}
+
+class GetMetricsArgument : Argument {
+  public:
+    bool reset = false;
+};
+DDB_IPC_DEFINE_TYPE_WITH_DEFAULT(GetMetricsArgument, reset);
+COMMAND(get_metrics, GetMetricsArgument) {
+    json latency = json::object();
+    for (int p = 0; p < DDB_IPC_PRIORITY_CLASSES; p++) {
+        latency[priority_names[p]] = request_latency[p].summary();
+        if (args.reset) {
+            request_latency[p].reset();
+        }
+    }
+    json resp = ok_response(id);
+    resp["latency"] = latency;
+    resp["pl_lock_hold"] = pl_lock_hold.summary();
+    if (args.reset) {
+        pl_lock_hold.reset();
+    }
+    return resp;
+}
+
+}  // namespace ddb_ipc
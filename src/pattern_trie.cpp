@@ -0,0 +1,128 @@
+#include "pattern_trie.hpp"
+
+namespace ddb_ipc {
+
+bool PatternTrie::Node::empty() const {
+    return subscribers.empty() && children.empty() && !any_char && !any_seq;
+}
+
+void PatternTrie::insert(const std::string& pattern, int subscriber) {
+    Node* node = &root;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        std::unique_ptr<Node>* next;
+        if (c == '*') {
+            // consecutive stars are equivalent to one
+            while (i + 1 < pattern.size() && pattern[i + 1] == '*') {
+                i++;
+            }
+            next = &node->any_seq;
+        } else if (c == '?') {
+            next = &node->any_char;
+        } else {
+            next = &node->children[c];
+        }
+        if (!*next) {
+            *next = std::make_unique<Node>();
+        }
+        node = next->get();
+    }
+    node->subscribers.insert(subscriber);
+}
+
+void PatternTrie::erase(Node& node, int subscriber) {
+    node.subscribers.erase(subscriber);
+    auto child = node.children.begin();
+    while (child != node.children.end()) {
+        erase(*child->second, subscriber);
+        if (child->second->empty()) {
+            child = node.children.erase(child);
+        } else {
+            child++;
+        }
+    }
+    for (auto next : {&node.any_char, &node.any_seq}) {
+        if (*next) {
+            erase(**next, subscriber);
+            if ((*next)->empty()) {
+                next->reset();
+            }
+        }
+    }
+}
+
+void PatternTrie::erase(int subscriber) { erase(root, subscriber); }
+
+void PatternTrie::clear() {
+    root.children.clear();
+    root.any_char.reset();
+    root.any_seq.reset();
+    root.subscribers.clear();
+}
+
+bool PatternTrie::empty() const { return root.empty(); }
+
+void PatternTrie::match(
+    const Node& node, const std::string& key, size_t pos, std::set<int>& result
+) {
+    if (pos == key.size()) {
+        result.insert(node.subscribers.begin(), node.subscribers.end());
+    } else {
+        auto child = node.children.find(key[pos]);
+        if (child != node.children.end()) {
+            match(*child->second, key, pos + 1, result);
+        }
+        if (node.any_char) {
+            match(*node.any_char, key, pos + 1, result);
+        }
+    }
+    if (node.any_seq) {
+        const Node& seq = *node.any_seq;
+        if (seq.children.empty() && !seq.any_char && !seq.any_seq) {
+            // a trailing star, i.e. a prefix pattern, matches the rest
+            result.insert(seq.subscribers.begin(), seq.subscribers.end());
+            return;
+        }
+        for (size_t p = pos; p <= key.size(); p++) {
+            match(seq, key, p, result);
+        }
+    }
+}
+
+std::set<int> PatternTrie::match(const std::string& key) const {
+    std::set<int> result;
+    match(root, key, 0, result);
+    return result;
+}
+
+void PatternTrie::patterns(
+    const Node& node, std::string& pattern, std::vector<std::string>& result
+) {
+    if (!node.subscribers.empty()) {
+        result.push_back(pattern);
+    }
+    for (auto& [c, child] : node.children) {
+        pattern.push_back(c);
+        patterns(*child, pattern, result);
+        pattern.pop_back();
+    }
+    if (node.any_char) {
+        pattern.push_back('?');
+        patterns(*node.any_char, pattern, result);
+        pattern.pop_back();
+    }
+    if (node.any_seq) {
+        pattern.push_back('*');
+        patterns(*node.any_seq, pattern, result);
+        pattern.pop_back();
+    }
+}
+
+std::vector<std::string> PatternTrie::patterns() const {
+    std::vector<std::string> result;
+    std::string pattern;
+    patterns(root, pattern, result);
+    return result;
+}
+
+}  // namespace ddb_ipc
@@ -0,0 +1,277 @@
+#include "playlist_diff.hpp"
+
+#include <deadbeef/deadbeef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ddb_ipc.hpp"
+#include "response.hpp"
+#include "trace.hpp"
+
+namespace ddb_ipc {
+
+// The contents of a playlist as last sent to its subscribers. Items and the
+// playlist are referenced so that their addresses identify them.
+class PlaylistSnapshot {
+  public:
+    ddb_playlist_t* plt;
+    std::vector<DB_playItem_t*> items;
+    int64_t generation = 0;
+    std::set<int> subscribers;
+};
+
+// only accessed on the IPC thread
+std::list<PlaylistSnapshot> snapshots;
+std::atomic<bool> diff_pending = false;
+
+std::vector<DB_playItem_t*> playlist_items(ddb_playlist_t* plt) {
+    std::vector<DB_playItem_t*> items;
+    items.reserve(ddb_api->plt_get_item_count(plt, PL_MAIN));
+    DB_playItem_t* it = ddb_api->plt_get_head_item(plt, PL_MAIN);
+    while (it != NULL) {
+        // keep the reference returned by the API
+        items.push_back(it);
+        it = ddb_api->pl_get_next(it, PL_MAIN);
+    }
+    return items;
+}
+
+void unref_items(std::vector<DB_playItem_t*>& items) {
+    for (auto it : items) {
+        ddb_api->pl_item_unref(it);
+    }
+    items.clear();
+}
+
+// Append [start, count] to ranges, or extend the last range if adjacent
+void add_to_range(json& ranges, int start) {
+    if (!ranges.empty()) {
+        json& last = ranges.back();
+        if (last[0].get<int>() + last[1].get<int>() == start) {
+            last[1] = last[1].get<int>() + 1;
+            return;
+        }
+    }
+    ranges.push_back({start, 1});
+}
+
+// Compute the difference between two lists of items. Items in both lists that
+// are part of a longest common subsequence are kept in place; the rest of the
+// common items are reported as moved.
+json diff_items(
+    const std::vector<DB_playItem_t*>& from,
+    const std::vector<DB_playItem_t*>& to
+) {
+    std::unordered_map<DB_playItem_t*, int> from_idx;
+    from_idx.reserve(from.size());
+    for (size_t i = 0; i < from.size(); i++) {
+        from_idx[from[i]] = i;
+    }
+    // (old index, new index) of common items, in new order
+    std::vector<std::pair<int, int>> common;
+    std::vector<bool> present(from.size(), false);
+    json inserted = json::array();
+    for (size_t j = 0; j < to.size(); j++) {
+        auto f = from_idx.find(to[j]);
+        if (f == from_idx.end()) {
+            add_to_range(inserted, j);
+        } else {
+            common.push_back({f->second, j});
+            present[f->second] = true;
+        }
+    }
+    json removed = json::array();
+    for (size_t i = 0; i < from.size(); i++) {
+        if (!present[i]) {
+            add_to_range(removed, i);
+        }
+    }
+
+    // longest increasing subsequence of old indices by patience sorting
+    std::vector<int> tails;  // indices into common
+    std::vector<int> pred(common.size(), -1);
+    for (size_t k = 0; k < common.size(); k++) {
+        auto pos = std::lower_bound(
+            tails.begin(),
+            tails.end(),
+            common[k].first,
+            [&](int t, int v) { return common[t].first < v; }
+        );
+        if (pos != tails.begin()) {
+            pred[k] = *(pos - 1);
+        }
+        if (pos == tails.end()) {
+            tails.push_back(k);
+        } else {
+            *pos = k;
+        }
+    }
+    std::vector<bool> kept(common.size(), false);
+    for (int k = tails.empty() ? -1 : tails.back(); k >= 0; k = pred[k]) {
+        kept[k] = true;
+    }
+
+    json moved = json::array();
+    for (size_t k = 0; k < common.size(); k++) {
+        if (kept[k]) {
+            continue;
+        }
+        auto [i, j] = common[k];
+        if (!moved.empty()) {
+            json& last = moved.back();
+            int n = last[2];
+            if (last[0].get<int>() + n == i && last[1].get<int>() + n == j) {
+                last[2] = n + 1;
+                continue;
+            }
+        }
+        moved.push_back({i, j, 1});
+    }
+    if (removed.empty() && inserted.empty() && moved.empty()) {
+        return nullptr;
+    }
+    return json{{"removed", removed}, {"moved", moved}, {"inserted", inserted}};
+}
+
+void diff_playlists() {
+    diff_pending = false;
+    auto logger = get_logger();
+    // sent once all snapshots are updated, as a failed send drops the
+    // subscriptions of its connection, and with them possibly the snapshot
+    std::vector<std::pair<int, json>> events;
+    auto snap = snapshots.begin();
+    while (snap != snapshots.end()) {
+        pl_lock_traced();
+        int idx = ddb_api->plt_get_idx(snap->plt);
+        std::vector<DB_playItem_t*> items;
+        if (idx >= 0) {
+            items = playlist_items(snap->plt);
+        }
+        pl_unlock_traced();
+        json event;
+        if (idx < 0) {
+            event = json{
+                {"event", "playlist-deleted"},
+                {"generation", snap->generation + 1},
+            };
+        } else {
+            event = diff_items(snap->items, items);
+            if (!event.is_null()) {
+                event["event"] = "playlist-changed";
+                event["idx"] = idx;
+                event["generation"] = snap->generation + 1;
+                event["count"] = items.size();
+            }
+        }
+        if (!event.is_null()) {
+            snap->generation++;
+            logger->debug(
+                "Playlist {} changed, generation {}.", idx, snap->generation
+            );
+            for (int socket : snap->subscribers) {
+                events.emplace_back(socket, event);
+            }
+        }
+        unref_items(snap->items);
+        if (idx < 0) {
+            unref_items(items);
+            ddb_api->plt_unref(snap->plt);
+            snap = snapshots.erase(snap);
+        } else {
+            snap->items = std::move(items);
+            snap++;
+        }
+    }
+    for (auto& [socket, event] : events) {
+        send_response(event, socket);
+    }
+}
+
+void on_playlist_content_changed() {
+    // a burst of changes needs only one diff
+    if (!diff_pending.exchange(true)) {
+        post(diff_playlists);
+    }
+}
+
+void drop_playlist_subscriptions(int socket) {
+    auto snap = snapshots.begin();
+    while (snap != snapshots.end()) {
+        snap->subscribers.erase(socket);
+        if (snap->subscribers.empty()) {
+            unref_items(snap->items);
+            ddb_api->plt_unref(snap->plt);
+            snap = snapshots.erase(snap);
+        } else {
+            snap++;
+        }
+    }
+}
+
+class SubscribePlaylistArgument : Argument {
+  public:
+    int idx;
+    int socket;
+};
+DDB_IPC_DEFINE_TYPE(SubscribePlaylistArgument, idx, socket);
+COMMAND(subscribe_playlist, SubscribePlaylistArgument) {
+    if (diff_pending) {
+        // bring the snapshots up to date first, as the new subscriber's
+        // generation and count must describe the playlist as it is now
+        diff_playlists();
+    }
+    pl_lock_traced();
+    ddb_playlist_t* plt = ddb_api->plt_get_for_idx(args.idx);
+    if (!plt) {
+        pl_unlock_traced();
+        return error_response(id, "No playlist with given idx.");
+    }
+    auto snap = std::find_if(
+        snapshots.begin(),
+        snapshots.end(),
+        [&](PlaylistSnapshot& s) { return s.plt == plt; }
+    );
+    if (snap == snapshots.end()) {
+        snap = snapshots.emplace(snapshots.end());
+        snap->plt = plt;
+        snap->items = playlist_items(plt);
+    } else {
+        ddb_api->plt_unref(plt);
+    }
+    snap->subscribers.insert(args.socket);
+    json resp = ok_response(id);
+    resp["generation"] = snap->generation;
+    resp["count"] = snap->items.size();
+    pl_unlock_traced();
+    return resp;
+}
+
+COMMAND(unsubscribe_playlist, SubscribePlaylistArgument) {
+    pl_lock_traced();
+    ddb_playlist_t* plt = ddb_api->plt_get_for_idx(args.idx);
+    pl_unlock_traced();
+    if (!plt) {
+        return error_response(id, "No playlist with given idx.");
+    }
+    for (auto snap = snapshots.begin(); snap != snapshots.end(); snap++) {
+        if (snap->plt == plt && snap->subscribers.erase(args.socket)) {
+            if (snap->subscribers.empty()) {
+                unref_items(snap->items);
+                ddb_api->plt_unref(snap->plt);
+                snapshots.erase(snap);
+            }
+            ddb_api->plt_unref(plt);
+            return ok_response(id);
+        }
+    }
+    ddb_api->plt_unref(plt);
+    return error_response(id, "Not subscribed to playlist with given idx.");
+}
+
+}  // namespace ddb_ipc
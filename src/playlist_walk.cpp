@@ -0,0 +1,67 @@
+#include "playlist_walk.hpp"
+
+#include <algorithm>
+
+#include "ddb_ipc.hpp"
+#include "trace.hpp"
+
+namespace ddb_ipc {
+
+PlaylistWalk::PlaylistWalk(ddb_playlist_t* _plt) :
+    plt(_plt),
+    generation(ddb_api->plt_get_modification_idx(_plt)),
+    max_items(std::max(
+        0,
+        ddb_api->conf_get_int(
+            DDB_IPC_PROJECT_ID ".lock_chunk_items",
+            DDB_IPC_DEFAULT_LOCK_CHUNK_ITEMS
+        )
+    )),
+    max_time(std::max(
+        0,
+        ddb_api->conf_get_int(
+            DDB_IPC_PROJECT_ID ".lock_chunk_us", DDB_IPC_DEFAULT_LOCK_CHUNK_US
+        )
+    )),
+    chunk_start(std::chrono::steady_clock::now()) {}
+
+bool PlaylistWalk::next(
+    DB_playItem_t* item,
+    int iter,
+    bool end_chunk,
+    const std::function<void()>& unlocked
+) {
+    items++;
+    if (!end_chunk && max_items > 0 && items > max_items) {
+        end_chunk = true;
+    }
+    // checking the clock on every item would dominate the walk
+    if (!end_chunk && max_time.count() > 0 &&
+        items % DDB_IPC_INTERRUPT_CHECK_ITEMS == 0 &&
+        std::chrono::steady_clock::now() - chunk_start >= max_time)
+    {
+        end_chunk = true;
+    }
+    if (!end_chunk) {
+        return true;
+    }
+    pl_unlock_traced();
+    if (unlocked) {
+        unlocked();
+    }
+    pl_lock_traced();
+    items = 1;
+    chunk_start = std::chrono::steady_clock::now();
+    int modification = ddb_api->plt_get_modification_idx(plt);
+    if (modification == generation) {
+        return true;
+    }
+    // the item is referenced, so no other item can have taken its address
+    if (ddb_api->plt_get_item_idx(plt, item, iter) < 0) {
+        return false;
+    }
+    generation = modification;
+    return true;
+}
+
+}  // namespace ddb_ipc
@@ -0,0 +1,195 @@
+#include "playqueue.hpp"
+
+#include <deadbeef/deadbeef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "ddb_ipc.hpp"
+#include "response.hpp"
+#include "trace.hpp"
+
+namespace ddb_ipc {
+
+// referenced items of the queue as last broadcast; only accessed on the IPC
+// thread
+std::vector<DB_playItem_t*> last_queue;
+std::atomic<bool> queue_event_pending = false;
+
+// Must be called with pl_lock held
+json queue_item_as_json(DB_playItem_t* it) {
+    int plt_idx = -1, idx = -1;
+    ddb_playlist_t* plt = ddb_api->pl_get_playlist(it);
+    if (plt) {
+        plt_idx = ddb_api->plt_get_idx(plt);
+        idx = ddb_api->plt_get_item_idx(plt, it, PL_MAIN);
+        ddb_api->plt_unref(plt);
+    }
+    return json{{"playlist", plt_idx}, {"idx", idx}};
+}
+
+// Returns the referenced items of the queue; must be called with pl_lock held
+std::vector<DB_playItem_t*> queue_items() {
+    std::vector<DB_playItem_t*> items;
+    int count = ddb_api->playqueue_get_count();
+    for (int i = 0; i < count; i++) {
+        DB_playItem_t* it = ddb_api->playqueue_get_item(i);
+        if (it) {
+            items.push_back(it);
+        }
+    }
+    return items;
+}
+
+json queue_as_json(const std::vector<DB_playItem_t*>& items) {
+    json queue = json::array();
+    for (auto it : items) {
+        queue.push_back(queue_item_as_json(it));
+    }
+    return queue;
+}
+
+void notify_playqueue_changed() {
+    ddb_api->sendmessage(
+        DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_PLAYQUEUE, 0
+    );
+}
+
+void broadcast_playqueue() {
+    queue_event_pending = false;
+    pl_lock_traced();
+    std::vector<DB_playItem_t*> items = queue_items();
+    if (items == last_queue) {
+        // e.g. the tail of a burst of notifications for one batch
+        pl_unlock_traced();
+        for (auto it : items) {
+            ddb_api->pl_item_unref(it);
+        }
+        return;
+    }
+    json queue = queue_as_json(items);
+    pl_unlock_traced();
+    for (auto it : last_queue) {
+        ddb_api->pl_item_unref(it);
+    }
+    last_queue = std::move(items);
+    broadcast(json{{"event", "queue-changed"}, {"queue", queue}});
+}
+
+void on_playqueue_changed() {
+    if (!queue_event_pending.exchange(true)) {
+        post(broadcast_playqueue);
+    }
+}
+
+COMMAND(queue_get, Argument) {
+    pl_lock_traced();
+    std::vector<DB_playItem_t*> items = queue_items();
+    json queue = queue_as_json(items);
+    pl_unlock_traced();
+    for (auto it : items) {
+        ddb_api->pl_item_unref(it);
+    }
+    json resp = ok_response(id);
+    resp["queue"] = queue;
+    return resp;
+}
+
+class QueueAddArgument : Argument {
+  public:
+    std::vector<std::pair<int, int>> items;
+    std::optional<int> position = {};
+};
+void from_json(const json& j, QueueAddArgument& a) {
+    a.items = j.at("items").get<std::vector<std::pair<int, int>>>();
+    if (j.contains("position")) {
+        a.position = j.at("position").get<int>();
+    }
+}
+COMMAND(queue_add, QueueAddArgument) {
+    std::vector<DB_playItem_t*> tracks;
+    pl_lock_traced();
+    // resolve every item before touching the queue, so that a bad item
+    // leaves it unchanged
+    for (auto [plt_idx, idx] : args.items) {
+        ddb_playlist_t* plt = ddb_api->plt_get_for_idx(plt_idx);
+        DB_playItem_t* it =
+            plt ? ddb_api->plt_get_item_for_idx(plt, idx, PL_MAIN) : NULL;
+        if (plt) {
+            ddb_api->plt_unref(plt);
+        }
+        if (!it) {
+            pl_unlock_traced();
+            for (auto t : tracks) {
+                ddb_api->pl_item_unref(t);
+            }
+            return error_response(
+                id,
+                "No track " + std::to_string(idx) + " in playlist " +
+                    std::to_string(plt_idx) + "."
+            );
+        }
+        tracks.push_back(it);
+    }
+    int count = ddb_api->playqueue_get_count();
+    int pos = args.position ? args.position.value() : count;
+    if (pos < 0 || pos > count) {
+        pl_unlock_traced();
+        for (auto t : tracks) {
+            ddb_api->pl_item_unref(t);
+        }
+        return bad_request_response(
+            id, "Argument position must be from [0, queue length]."
+        );
+    }
+    for (auto t : tracks) {
+        if (pos == ddb_api->playqueue_get_count()) {
+            ddb_api->playqueue_push(t);
+        } else {
+            ddb_api->playqueue_insert_at(pos, t);
+        }
+        pos++;
+        ddb_api->pl_item_unref(t);
+    }
+    pl_unlock_traced();
+    notify_playqueue_changed();
+    return ok_response(id);
+}
+
+class QueueRemoveArgument : Argument {
+  public:
+    std::vector<int> indices;
+};
+DDB_IPC_DEFINE_TYPE(QueueRemoveArgument, indices);
+COMMAND(queue_remove, QueueRemoveArgument) {
+    std::vector<int> indices = args.indices;
+    // remove from the back so that the remaining indices stay valid
+    std::sort(indices.begin(), indices.end(), std::greater<int>());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    pl_lock_traced();
+    int count = ddb_api->playqueue_get_count();
+    if (!indices.empty() && (indices.front() >= count || indices.back() < 0)) {
+        pl_unlock_traced();
+        return bad_request_response(
+            id, "Argument indices must be from [0, queue length)."
+        );
+    }
+    for (int i : indices) {
+        ddb_api->playqueue_remove_nth(i);
+    }
+    pl_unlock_traced();
+    notify_playqueue_changed();
+    return ok_response(id);
+}
+
+COMMAND(queue_clear, Argument) {
+    pl_lock_traced();
+    ddb_api->playqueue_clear();
+    pl_unlock_traced();
+    notify_playqueue_changed();
+    return ok_response(id);
+}
+
+}  // namespace ddb_ipc
@@ -2,17 +2,16 @@
 
 #include <deadbeef/deadbeef.h>
 
-#include <nlohmann/json.hpp>
+#include <atomic>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 #include "commands.hpp"
 #include "ddb_ipc.hpp"
+#include "ipc_json.hpp"
 #include "response.hpp"
 
-using json = nlohmann::json;
-
-using json = nlohmann::json;
-
 template <>
 struct fmt::formatter<ddb_shuffle_t> {
     // Parses format specifiers; we can ignore them in this simple case.
@@ -66,7 +65,10 @@ struct fmt::formatter<ddb_repeat_t> {
 
 namespace ddb_ipc {
 
-std::map<int, std::set<std::string>> observers = {};
+PatternTrie observers;
+// the configuration as of the last change, to tell which keys changed
+std::unordered_map<std::string, std::string> config_snapshot;
+std::atomic<bool> observers_pending = false;
 
 json get_property_volume() {
     float mindb = ddb_api->volume_get_min_db();
@@ -109,7 +111,7 @@ json get_property_repeat() {
     }
 }
 
-void set_property_shuffle(json arg) {
+ConfigWrite set_property_shuffle(json arg) {
     auto logger = get_logger();
     auto shuffles = std::map<std::string, ddb_shuffle_t>{
         {"off", DDB_SHUFFLE_OFF},
@@ -124,8 +126,7 @@ void set_property_shuffle(json arg) {
     }
     if (shuffles.count(arg)) {
         logger->debug("setting shuffle: {}", shuffles.at(arg));
-        ddb_api->conf_set_int("playback.order", (int)shuffles.at(arg));
-        ddb_api->sendmessage(DB_EV_CONFIGCHANGED, 0, 0, 0);
+        return {"playback.order", (int)shuffles.at(arg)};
     } else {
         throw std::invalid_argument(
             "Invalid argument:shuffle must be one of: off, tracks, albums, "
@@ -134,7 +135,7 @@ void set_property_shuffle(json arg) {
     }
 }
 
-void set_property_repeat(json arg) {
+ConfigWrite set_property_repeat(json arg) {
     auto repeats = std::map<std::string, ddb_repeat_t>{
         {"all", DDB_REPEAT_ALL},
         {"off", DDB_REPEAT_OFF},
@@ -145,15 +146,12 @@ void set_property_repeat(json arg) {
             "Invalid argument: repeat must be a string."
         );
     }
-    try {
-        ddb_api->conf_set_int("playback.loop", (int)repeats.at(arg));
-        ddb_api->sendmessage(DB_EV_CONFIGCHANGED, 0, 0, 0);
-        // ddb_api->streamer_set_repeat(values.at(value));
-    } catch (std::invalid_argument& e) {
+    if (!repeats.count(arg)) {
         throw std::invalid_argument(
             "Invalid argument:repeat must be one of: off, one, all."
         );
     }
+    return {"playback.loop", (int)repeats.at(arg)};
 }
 
 json property_as_json(std::string prop) {
@@ -184,19 +182,40 @@ class GetPropertyArgument : Argument {
   public:
     std::string property;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(GetPropertyArgument, property);
+DDB_IPC_DEFINE_TYPE(GetPropertyArgument, property);
+json property_value(const std::string& prop) {
+    auto getter = getters.find(prop);
+    if (getter != getters.end()) {
+        return getter->second();
+    }
+    return property_as_json(prop);
+}
+
 COMMAND(get_property, GetPropertyArgument) {
-    std::string prop = args.property;
     json resp = ok_response(id);
     resp["property"] = args.property;
-    if (getters.count(prop)) {
-        resp["value"] = getters[prop]();
-    } else {
-        resp["value"] = property_as_json(prop);
-    }
+    resp["value"] = property_value(args.property);
     return (resp);
 }
 
+class GetPropertiesArgument : Argument {
+  public:
+    std::vector<std::string> properties;
+};
+DDB_IPC_DEFINE_TYPE(GetPropertiesArgument, properties);
+COMMAND(get_properties, GetPropertiesArgument) {
+    json values = json::object();
+    // hold the configuration still so that the values are consistent
+    ddb_api->conf_lock();
+    for (auto& prop : args.properties) {
+        values[prop] = property_value(prop);
+    }
+    ddb_api->conf_unlock();
+    json resp = ok_response(id);
+    resp["values"] = values;
+    return resp;
+}
+
 std::map<std::string, ipc_property_setter> setters = {
     {"shuffle", set_property_shuffle},
     {"repeat", set_property_repeat},
@@ -206,44 +225,201 @@ class SetPropertyArgument : public GetPropertyArgument {
   public:
     json value;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(SetPropertyArgument, property, value)
+DDB_IPC_DEFINE_TYPE(SetPropertyArgument, property, value)
+// Translate a property value into the configuration value to write
+ConfigWrite property_write(const std::string& prop, json value) {
+    auto setter = setters.find(prop);
+    if (setter != setters.end()) {
+        return setter->second(value);
+    }
+    if (!value.is_number() && !value.is_string()) {
+        throw std::invalid_argument(
+            "Argument property must be a string or number"
+        );
+    }
+    return {prop, value};
+}
+
+// Write the values with the configuration locked, then notify DeaDBeeF, and
+// through it the property observers, once
+void apply_config_writes(const std::vector<ConfigWrite>& writes) {
+    ddb_api->conf_lock();
+    for (auto& w : writes) {
+        const char* key = w.key.c_str();
+        if (w.value.is_number_integer()) {
+            ddb_api->conf_set_int(key, w.value);
+        } else if (w.value.is_number_float()) {
+            ddb_api->conf_set_float(key, w.value);
+        } else {
+            ddb_api->conf_set_str(
+                key, w.value.get_ref<const std::string&>().c_str()
+            );
+        }
+    }
+    ddb_api->conf_unlock();
+    ddb_api->sendmessage(DB_EV_CONFIGCHANGED, 0, 0, 0);
+}
+
 COMMAND(set_property, SetPropertyArgument) {
-    std::string prop = args.property;
-    if (setters.count(prop)) {
-        try {
-            setters[prop](args.value);
-        } catch (std::exception& e) {
+    ConfigWrite write;
+    try {
+        write = property_write(args.property, args.value);
+    } catch (std::invalid_argument& e) {
+        if (setters.count(args.property)) {
             return error_response(id, e.what());
         }
-        return ok_response(id);
-    }
-    const char* propc = prop.c_str();
-    if (args.value.is_number_integer()) {
-        ddb_api->conf_set_int(propc, args.value);
-    } else if (args.value.is_number_float()) {
-        ddb_api->conf_set_float(propc, args.value);
-    } else if (args.value.is_string()) {
-        std::string val = args.value;
-        ddb_api->conf_set_str(propc, val.c_str());
-    } else {
-        return bad_request_response(
-            id, std::string("Argument property must be a string or number")
-        );
+        return bad_request_response(id, e.what());
+    }
+    apply_config_writes({write});
+    return ok_response(id);
+}
+
+class SetPropertiesArgument : Argument {
+  public:
+    std::map<std::string, json> properties;
+};
+DDB_IPC_DEFINE_TYPE(SetPropertiesArgument, properties);
+COMMAND(set_properties, SetPropertiesArgument) {
+    std::vector<ConfigWrite> writes;
+    // nothing is written unless every value is valid
+    for (auto& [prop, value] : args.properties) {
+        try {
+            writes.push_back(property_write(prop, value));
+        } catch (std::invalid_argument& e) {
+            // as for set-property: a value the setter rejects is an error,
+            // a value of the wrong type a bad request
+            if (setters.count(prop)) {
+                return error_response(id, prop + ": " + e.what());
+            }
+            return bad_request_response(id, prop + ": " + e.what());
+        }
+    }
+    if (!writes.empty()) {
+        apply_config_writes(writes);
     }
     return ok_response(id);
 }
 
+// Call f with the key and value of each configuration item that pattern
+// matches, or at least of those that it and some other observed pattern match;
+// the configuration must be locked
+template <typename F>
+void for_each_observed_key(const std::string& pattern, F f) {
+    size_t wildcard = pattern.find_first_of("*?");
+    if (wildcard == std::string::npos) {
+        const char* value =
+            ddb_api->conf_get_str_fast(pattern.c_str(), nullptr);
+        if (value) {
+            f(pattern, value);
+        }
+        return;
+    }
+    // conf_find finds the keys that start with the prefix
+    std::string prefix = pattern.substr(0, wildcard);
+    for (DB_conf_item_t* item = ddb_api->conf_find(prefix.c_str(), NULL);
+         item != NULL;
+         item = ddb_api->conf_find(prefix.c_str(), item))
+    {
+        if (!observers.match(item->key).empty()) {
+            f(item->key, item->value);
+        }
+    }
+}
+
+// Update the snapshot of the observed configuration keys, returning the keys
+// whose value changed
+std::vector<std::string> changed_config_keys() {
+    std::vector<std::string> changed;
+    std::unordered_map<std::string, std::string> snapshot;
+    snapshot.reserve(config_snapshot.size());
+    ddb_api->conf_lock();
+    for (auto& pattern : observers.patterns()) {
+        for_each_observed_key(
+            pattern,
+            [&](const std::string& key, const char* value) {
+                if (snapshot.count(key)) {
+                    return;
+                }
+                auto prev = config_snapshot.find(key);
+                if (prev == config_snapshot.end() || prev->second != value) {
+                    changed.push_back(key);
+                }
+                snapshot.emplace(key, value);
+            }
+        );
+    }
+    ddb_api->conf_unlock();
+    config_snapshot.swap(snapshot);
+    return changed;
+}
+
+// Add the keys a new pattern matches to the snapshot, without reporting
+// changes to the keys already in it
+void snapshot_config_keys(const std::string& pattern) {
+    ddb_api->conf_lock();
+    for_each_observed_key(
+        pattern,
+        [&](const std::string& key, const char* value) {
+            config_snapshot.emplace(key, value);
+        }
+    );
+    ddb_api->conf_unlock();
+}
+
+void send_property_change(std::string prop, json value, std::set<int> sockets) {
+    auto logger = get_logger();
+    logger->debug("Property {}; value {}.", prop, value.dump());
+    json resp = {
+        {"event", "property-change"}, {"property", prop}, {"value", value}
+    };
+    for (int socket : sockets) {
+        send_response(resp, socket);
+    }
+}
+
+void send_property_changes() {
+    observers_pending = false;
+    if (observers.empty()) {
+        return;
+    }
+    // wrapped properties are computed from several sources, so there is no
+    // telling whether they changed
+    for (auto& [prop, getter] : getters) {
+        std::set<int> sockets = observers.match(prop);
+        if (!sockets.empty()) {
+            send_property_change(prop, getter(), sockets);
+        }
+    }
+    for (auto& key : changed_config_keys()) {
+        if (getters.count(key)) {
+            continue;
+        }
+        std::set<int> sockets = observers.match(key);
+        if (!sockets.empty()) {
+            send_property_change(key, property_as_json(key), sockets);
+        }
+    }
+}
+
+void notify_property_observers() {
+    if (!observers_pending.exchange(true)) {
+        post(send_property_changes);
+    }
+}
+
 class ObservePropertyArgument : public GetPropertyArgument {
   public:
     int socket;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(ObservePropertyArgument, property, socket)
+DDB_IPC_DEFINE_TYPE(ObservePropertyArgument, property, socket)
 COMMAND(observe_property, ObservePropertyArgument) {
-    int s = (int)args.socket;
-    if (!observers.count(s)) {
-        observers[s] = std::set<std::string>({});
+    if (observers.empty()) {
+        // values left from earlier observers may be out of date
+        config_snapshot.clear();
     }
-    observers[s].insert((std::string)args.property);
+    observers.insert(args.property, args.socket);
+    // track changes to the keys it matches from now on
+    snapshot_config_keys(args.property);
     return ok_response(id);
 }
 }  // namespace ddb_ipc
@@ -0,0 +1,144 @@
+#include "request.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "ddb_ipc.hpp"
+
+namespace ddb_ipc {
+
+std::mutex requests_mutex;
+std::vector<pending_request_t> pending_requests;
+thread_local pending_request_t current;
+
+bool PendingRequest::interrupt(RequestState s) {
+    int expected = DDB_IPC_REQUEST_PENDING;
+    if (!_state.compare_exchange_strong(expected, s)) {
+        return false;
+    }
+    // reach into the artwork plugin so that the lookup stops early; its
+    // callback will still be called, with DDB_ARTWORK_FLAG_CANCELLED set
+    int64_t sid = artwork_sid.load();
+    if (sid != 0 && ddb_artwork && ddb_artwork->cancel_queries_with_source_id)
+    {
+        ddb_artwork->cancel_queries_with_source_id(sid);
+    }
+    return true;
+}
+
+bool PendingRequest::interrupted() {
+    if (deadline && std::chrono::steady_clock::now() >= deadline.value()) {
+        interrupt(DDB_IPC_REQUEST_TIMED_OUT);
+    }
+    return state() != DDB_IPC_REQUEST_PENDING;
+}
+
+pending_request_t register_request(int socket, const Message& m) {
+    if (!m.id && !m.deadline_ms) {
+        return nullptr;
+    }
+    std::optional<deadline_t> deadline{};
+    if (m.deadline_ms) {
+        deadline = std::chrono::steady_clock::now() +
+                   std::chrono::milliseconds(m.deadline_ms.value());
+    }
+    auto req = std::make_shared<PendingRequest>(socket, m.id, deadline);
+    std::lock_guard lock(requests_mutex);
+    pending_requests.push_back(req);
+    return req;
+}
+
+void release_request(pending_request_t req) {
+    std::lock_guard lock(requests_mutex);
+    auto it = std::find(pending_requests.begin(), pending_requests.end(), req);
+    if (it != pending_requests.end()) {
+        pending_requests.erase(it);
+    }
+}
+
+pending_request_t current_request() { return current; }
+
+void set_current_request(pending_request_t req) { current = req; }
+
+int cancel_requests(int socket, int id) {
+    std::vector<pending_request_t> matches;
+    {
+        std::lock_guard lock(requests_mutex);
+        for (auto& req : pending_requests) {
+            if (req->socket == socket && req->id && req->id.value() == id) {
+                matches.push_back(req);
+            }
+        }
+    }
+    int n = 0;
+    for (auto& req : matches) {
+        if (req->interrupt(DDB_IPC_REQUEST_CANCELLED)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+void expire_requests() {
+    std::vector<pending_request_t> expired;
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard lock(requests_mutex);
+        for (auto& req : pending_requests) {
+            if (req->deadline && now >= req->deadline.value()) {
+                expired.push_back(req);
+            }
+        }
+    }
+    for (auto& req : expired) {
+        req->interrupt(DDB_IPC_REQUEST_TIMED_OUT);
+    }
+}
+
+int next_deadline_ms() {
+    std::lock_guard lock(requests_mutex);
+    std::optional<deadline_t> earliest{};
+    for (auto& req : pending_requests) {
+        if (req->deadline && req->state() == DDB_IPC_REQUEST_PENDING &&
+            (!earliest || req->deadline.value() < earliest.value()))
+        {
+            earliest = req->deadline;
+        }
+    }
+    if (!earliest) {
+        return -1;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        earliest.value() - std::chrono::steady_clock::now()
+    );
+    return ms.count() < 0 ? 0 : ms.count();
+}
+
+void drop_requests(int socket) {
+    std::vector<pending_request_t> dropped;
+    {
+        std::lock_guard lock(requests_mutex);
+        auto it = pending_requests.begin();
+        while (it != pending_requests.end()) {
+            if ((*it)->socket == socket) {
+                dropped.push_back(*it);
+                it = pending_requests.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+    for (auto& req : dropped) {
+        req->interrupt(DDB_IPC_REQUEST_DROPPED);
+    }
+}
+
+Response interrupted_response(const pending_request_t& req) {
+    if (req->state() == DDB_IPC_REQUEST_TIMED_OUT) {
+        return timeout_response(req->id);
+    }
+    return cancelled_response(req->id);
+}
+
+}  // namespace ddb_ipc
@@ -1,5 +1,8 @@
 #include "response.hpp"
 
+#include <charconv>
+#include <vector>
+
 namespace ddb_ipc {
 
 void to_json(json& j, const ResponseStatus& c) {
@@ -13,6 +16,12 @@ void to_json(json& j, const ResponseStatus& c) {
         case DDB_IPC_RESPONSE_BADQ:
             j = "BAD_REQUEST";
             break;
+        case DDB_IPC_RESPONSE_CANCELLED:
+            j = "CANCELLED";
+            break;
+        case DDB_IPC_RESPONSE_TIMEOUT:
+            j = "TIMEOUT";
+            break;
     }
 }
 
@@ -25,8 +34,17 @@ void to_json(json& j, const Response& r) {
     j["status"] = r.status;
 }
 
+void to_json(json& j, Response&& r) {
+    j = std::move(r.data);
+    if (r.id) {
+        int id = r.id.value();
+        j["request_id"] = id;
+    }
+    j["status"] = r.status;
+}
+
 Response ok_response(request_id id, json data) {
-    return Response(id, DDB_IPC_RESPONSE_OK, data);
+    return Response(id, DDB_IPC_RESPONSE_OK, std::move(data));
 };
 
 Response bad_request_response(request_id id, std::string mess) {
@@ -37,4 +55,91 @@ Response error_response(request_id id, std::string mess) {
     return Response(id, DDB_IPC_RESPONSE_ERR, {{"message", mess}});
 }
 
+Response cancelled_response(request_id id) {
+    return Response(
+        id, DDB_IPC_RESPONSE_CANCELLED, {{"message", "Request cancelled."}}
+    );
+}
+
+Response timeout_response(request_id id) {
+    return Response(
+        id, DDB_IPC_RESPONSE_TIMEOUT, {{"message", "Deadline exceeded."}}
+    );
+}
+
+// The serialized form of {"request_id":N,"status":"NAME"} is
+// prefix N suffix, or bare when there is no request id
+const char status_template_prefix[] = "{\"request_id\":";
+struct StatusTemplate {
+    std::string name;
+    std::string suffix;
+    std::string bare;
+};
+
+std::vector<StatusTemplate> make_status_templates() {
+    std::vector<StatusTemplate> templates;
+    for (auto s :
+         {DDB_IPC_RESPONSE_OK,
+          DDB_IPC_RESPONSE_ERR,
+          DDB_IPC_RESPONSE_BADQ,
+          DDB_IPC_RESPONSE_CANCELLED,
+          DDB_IPC_RESPONSE_TIMEOUT})
+    {
+        std::string name = json(s).get<std::string>();
+        std::string status = "\"status\":\"" + name + "\"}\n";
+        templates.push_back({name, "," + status, "{" + status});
+    }
+    return templates;
+}
+
+const std::vector<StatusTemplate> status_templates = make_status_templates();
+
+const StatusTemplate* status_template(const json& j) {
+    if (!j.is_object() || j.size() > 2) {
+        return nullptr;
+    }
+    auto status = j.find("status");
+    if (status == j.end() || !status->is_string()) {
+        return nullptr;
+    }
+    if (j.size() == 2) {
+        auto id = j.find("request_id");
+        if (id == j.end() || !id->is_number_integer()) {
+            return nullptr;
+        }
+    }
+    const auto& name = status->get_ref<const std::string&>();
+    for (auto& t : status_templates) {
+        if (t.name == name) {
+            return &t;
+        }
+    }
+    return nullptr;
+}
+
+void serialize_message(const json& j, std::string& out) {
+    out.clear();
+    const StatusTemplate* t = status_template(j);
+    if (t && j.size() == 1) {
+        out.append(t->bare);
+        return;
+    }
+    if (t) {
+        char id[24];
+        auto res = std::to_chars(
+            id, id + sizeof(id), j["request_id"].get<json::number_integer_t>()
+        );
+        out.append(status_template_prefix);
+        out.append(id, res.ptr);
+        out.append(t->suffix);
+        return;
+    }
+    // this is what json::dump does, minus the temporary string it returns
+    nlohmann::detail::serializer<json> s(
+        nlohmann::detail::output_adapter<char>(out), ' '
+    );
+    s.dump(j, false, false, 0);
+    out.push_back('\n');
+}
+
 }  // namespace ddb_ipc
@@ -0,0 +1,154 @@
+#include "response_cache.hpp"
+
+#include <atomic>
+#include <unordered_map>
+
+#include <deadbeef/deadbeef.h>
+
+#include "ddb_ipc.hpp"
+
+namespace ddb_ipc {
+
+// DeaDBeeF numbers its events from 1, and those about the current track from
+// DB_EV_FIRST; each range gets half of the generation counters
+const int event_range = DDB_IPC_RESPONSE_CACHE_EVENTS / 2;
+std::atomic<uint64_t> event_generations[DDB_IPC_RESPONSE_CACHE_EVENTS];
+// commands dispatched that have no cache policy; IPC thread only
+uint64_t uncached_commands = 0;
+// counts cache hits and insertions, to find the least recently used entry
+uint64_t use_clock = 0;
+
+std::atomic<uint64_t>* event_generation(uint32_t event) {
+    if (event >= DB_EV_FIRST && event < DB_EV_FIRST + event_range) {
+        return &event_generations[event_range + event - DB_EV_FIRST];
+    }
+    if (event < event_range) {
+        return &event_generations[event];
+    }
+    return nullptr;
+}
+
+struct CachedResponse {
+    uint64_t generation;
+    uint64_t last_used;
+    // the response, serialized around its request id
+    std::string before_id;
+    std::string after_id;
+    // the response to requests without an id
+    std::string without_id;
+};
+std::unordered_map<std::string, CachedResponse> cache;
+
+CacheLookup cache_lookup(const std::string& command, const json& args) {
+    CacheLookup lookup;
+    auto policy = cache_policies.find(command);
+    if (policy == cache_policies.end()) {
+        uncached_commands++;
+        return lookup;
+    }
+    auto& p = policy->second;
+    if (p.cacheable && !p.cacheable(args)) {
+        return lookup;
+    }
+    lookup.cacheable = true;
+    // the sum changes whenever one of its counters does
+    lookup.generation = uncached_commands;
+    for (uint32_t event : p.events) {
+        auto g = event_generation(event);
+        if (g) {
+            lookup.generation += g->load();
+        }
+    }
+    // object keys are sorted, so this is canonical; the socket is not an
+    // argument of the client's
+    json key_args = args;
+    if (key_args.is_object()) {
+        key_args.erase("socket");
+    }
+    lookup.key = command + '\n' + key_args.dump();
+    return lookup;
+}
+
+bool cached_response(
+    const CacheLookup& lookup, request_id id, std::string& out
+) {
+    if (!lookup.cacheable) {
+        return false;
+    }
+    auto it = cache.find(lookup.key);
+    if (it == cache.end()) {
+        return false;
+    }
+    if (it->second.generation != lookup.generation) {
+        cache.erase(it);
+        return false;
+    }
+    auto& c = it->second;
+    c.last_used = ++use_clock;
+    if (id) {
+        out.assign(c.before_id);
+        out.append(std::to_string(id.value()));
+        out.append(c.after_id);
+    } else {
+        out.assign(c.without_id);
+    }
+    return true;
+}
+
+void cache_response(const CacheLookup& lookup, const json& response) {
+    if (!lookup.cacheable || !response.is_object()) {
+        return;
+    }
+    auto status = response.find("status");
+    if (status == response.end() ||
+        *status == json(DDB_IPC_RESPONSE_CANCELLED) ||
+        *status == json(DDB_IPC_RESPONSE_TIMEOUT))
+    {
+        return;
+    }
+    if (cache.size() >= DDB_IPC_RESPONSE_CACHE_SIZE &&
+        cache.find(lookup.key) == cache.end())
+    {
+        // stale entries are never used again, so they go first
+        auto lru = cache.begin();
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->second.last_used < lru->second.last_used) {
+                lru = it;
+            }
+        }
+        cache.erase(lru);
+    }
+    // split the keys around request_id, where it goes in the sorted output
+    json before = json::object(), after = json::object();
+    for (auto& [key, value] : response.items()) {
+        if (key < "request_id") {
+            before[key] = value;
+        } else if (key > "request_id") {
+            after[key] = value;
+        }
+    }
+    CachedResponse c;
+    c.generation = lookup.generation;
+    c.last_used = ++use_clock;
+    std::string s;
+    serialize_message(before, s);
+    // without the closing brace and newline
+    c.before_id = s.substr(0, s.size() - 2);
+    c.before_id += before.empty() ? "\"request_id\":" : ",\"request_id\":";
+    serialize_message(after, s);
+    // without the opening brace
+    c.after_id = after.empty() ? "}\n" : "," + s.substr(1);
+    json without_id = response;
+    without_id.erase("request_id");
+    serialize_message(without_id, c.without_id);
+    cache[lookup.key] = std::move(c);
+}
+
+void invalidate_cached_responses(uint32_t event) {
+    auto g = event_generation(event);
+    if (g) {
+        g->fetch_add(1);
+    }
+}
+
+}  // namespace ddb_ipc
@@ -0,0 +1,89 @@
+#include "response_stream.hpp"
+
+#include "capture.hpp"
+#include "ddb_ipc.hpp"
+#include "fmt_optional.hpp"
+#include "trace.hpp"
+
+namespace ddb_ipc {
+
+ResponseStream::ResponseStream(int _socket, request_id _id, const char* key) :
+    socket(_socket),
+    id(_id),
+    out(output_buffer(_socket)),
+    element(""),
+    start(std::chrono::steady_clock::now()) {
+    out.clear();
+    out.append("{");
+    nlohmann::detail::serializer<json>(
+        nlohmann::detail::output_adapter<char>(out), ' '
+    )
+        .dump(json(key), false, false, 0);
+    out.append(":[");
+}
+
+void ResponseStream::push_back(std::string_view value) {
+    if (_failed) {
+        return;
+    }
+    if (!first_element) {
+        out.push_back(',');
+    }
+    first_element = false;
+    element.get_ref<json::string_t&>().assign(value);
+    // titles are not always valid UTF-8, and throwing halfway through the
+    // response would leave the client with half a message
+    nlohmann::detail::serializer<json>(
+        nlohmann::detail::output_adapter<char>(out),
+        ' ',
+        nlohmann::detail::error_handler_t::replace
+    )
+        .dump(element, false, false, 0);
+}
+
+void ResponseStream::finish(const Response& r) {
+    if (_failed) {
+        return;
+    }
+    std::string tail;
+    serialize_message(json(r), tail);
+    // the keys of r follow the array, in place of its opening brace
+    out.append("],");
+    out.append(tail, 1, std::string::npos);
+    flush(true);
+    if (_failed) {
+        return;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start
+    );
+    get_logger()->debug(
+        "Responded (request id: {}): streamed {} bytes in {} ms.",
+        id,
+        sent,
+        ms.count()
+    );
+    if (out.capacity() > DDB_IPC_MAX_RETAINED_BUFFER) {
+        std::string().swap(out);
+    }
+}
+
+void ResponseStream::flush(bool last) {
+    if (_failed || (!last && out.empty())) {
+        return;
+    }
+    TraceSpan span("write");
+    if (!send_bytes(socket, out.data(), out.size(), id)) {
+        _failed = true;
+        return;
+    }
+    // recorded once sent, so that the capture holds what the client got;
+    // without the trailing newline
+    std::string_view captured(out.data(), out.size() - (last ? 1 : 0));
+    capture_message_part(socket, '>', captured, first_chunk, last);
+    first_chunk = false;
+    sent += out.size();
+    out.clear();
+}
+
+}  // namespace ddb_ipc
@@ -0,0 +1,141 @@
+#include "timer_wheel.hpp"
+
+namespace ddb_ipc {
+
+void Timer::cancel() {
+    if (wheel) {
+        wheel->unlink(*this);
+    }
+}
+
+TimerWheel::TimerWheel(clock::duration tick) :
+    tick_length(tick), start(clock::now()) {}
+
+TimerWheel::~TimerWheel() {
+    for (auto& level : wheel) {
+        for (Timer*& head : level) {
+            while (head) {
+                unlink(*head);
+            }
+        }
+    }
+}
+
+void TimerWheel::arm(Timer& timer, clock::duration delay) {
+    timer.cancel();
+    // round up, and never expire on the tick being processed
+    uint64_t ticks = (delay + tick_length - clock::duration(1)) / tick_length;
+    timer.expires = current + (ticks > 0 ? ticks : 1);
+    insert(timer);
+    n_armed++;
+}
+
+void TimerWheel::insert(Timer& timer) {
+    uint64_t max_delta = (uint64_t(1) << (DDB_IPC_TIMER_WHEEL_BITS *
+                                          DDB_IPC_TIMER_WHEEL_LEVELS)) -
+                         1;
+    if (timer.expires < current) {
+        timer.expires = current;
+    } else if (timer.expires - current > max_delta) {
+        timer.expires = current + max_delta;
+    }
+    uint64_t delta = timer.expires - current;
+    int level = 0;
+    while (level < DDB_IPC_TIMER_WHEEL_LEVELS - 1 &&
+           delta >> (DDB_IPC_TIMER_WHEEL_BITS * (level + 1)))
+    {
+        level++;
+    }
+    int slot =
+        (timer.expires >> (DDB_IPC_TIMER_WHEEL_BITS * level)) & slot_mask;
+    Timer*& head = wheel[level][slot];
+    timer.prev = nullptr;
+    timer.next = head;
+    if (head) {
+        head->prev = &timer;
+    }
+    head = &timer;
+    timer.slot = &head;
+    timer.wheel = this;
+}
+
+void TimerWheel::unlink(Timer& timer) {
+    if (timer.prev) {
+        timer.prev->next = timer.next;
+    } else {
+        *timer.slot = timer.next;
+    }
+    if (timer.next) {
+        timer.next->prev = timer.prev;
+    }
+    timer.prev = timer.next = nullptr;
+    timer.slot = nullptr;
+    timer.wheel = nullptr;
+    n_armed--;
+}
+
+void TimerWheel::cascade(int level, int slot) {
+    Timer* t = wheel[level][slot];
+    wheel[level][slot] = nullptr;
+    while (t) {
+        Timer* next = t->next;
+        insert(*t);
+        t = next;
+    }
+}
+
+void TimerWheel::tick() {
+    current++;
+    // when a level wraps around, the next slot of the level above is due
+    for (int level = 1; level < DDB_IPC_TIMER_WHEEL_LEVELS; level++) {
+        if ((current >> (DDB_IPC_TIMER_WHEEL_BITS * (level - 1))) & slot_mask)
+        {
+            break;
+        }
+        cascade(
+            level, (current >> (DDB_IPC_TIMER_WHEEL_BITS * level)) & slot_mask
+        );
+    }
+    // callbacks may arm and cancel timers, including the ones in this slot
+    Timer*& head = wheel[0][current & slot_mask];
+    while (head) {
+        Timer& t = *head;
+        unlink(t);
+        if (t.callback) {
+            t.callback();
+        }
+    }
+}
+
+void TimerWheel::advance(clock::time_point now) {
+    uint64_t target = (now - start) / tick_length;
+    while (current < target) {
+        if (n_armed == 0) {
+            current = target;
+            break;
+        }
+        tick();
+    }
+}
+
+int TimerWheel::next_timeout_ms(clock::time_point now) const {
+    if (n_armed == 0) {
+        return -1;
+    }
+    // the next occupied slot of the lowest level, or else its wrap around,
+    // when the upper levels cascade
+    uint64_t ticks = slots - (current & slot_mask);
+    for (uint64_t i = 1; i < ticks; i++) {
+        if (wheel[0][(current + i) & slot_mask]) {
+            ticks = i;
+            break;
+        }
+    }
+    auto due = start + tick_length * (current + ticks);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        due - now + std::chrono::milliseconds(1) - clock::duration(1)
+    );
+    return ms.count() < 0 ? 0 : ms.count();
+}
+
+}  // namespace ddb_ipc
@@ -0,0 +1,164 @@
+#include "trace.hpp"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+#include "ddb_ipc.hpp"
+#include "metrics.hpp"
+#include "response.hpp"
+
+namespace ddb_ipc {
+
+std::atomic<bool> trace_enabled = false;
+
+// A ring of the most recent spans, written without locks. Each slot carries a
+// sequence number that is odd while the slot is being written and 2 * (n + 1)
+// once span number n is complete in it, so that a reader can tell whether
+// the fields it copied belong together.
+struct TraceSlot {
+    std::atomic<uint64_t> seq;
+    std::atomic<const char*> name;
+    std::atomic<const char*> detail;
+    std::atomic<trace_time_t> start;
+    std::atomic<trace_time_t> end;
+    std::atomic<int> tid;
+    // INT64_MIN if the span belongs to no request
+    std::atomic<int64_t> request;
+};
+TraceSlot trace_ring[DDB_IPC_TRACE_SPANS];
+std::atomic<uint64_t> trace_head = 0;
+// spans before this one have been dumped with clear set
+std::atomic<uint64_t> trace_floor = 0;
+
+thread_local request_id traced_request;
+
+trace_time_t trace_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()
+    )
+        .count();
+}
+
+int trace_tid() {
+    thread_local int tid = syscall(SYS_gettid);
+    return tid;
+}
+
+void trace_span(
+    const char* name,
+    trace_time_t start,
+    trace_time_t end,
+    request_id id,
+    const char* detail
+) {
+    uint64_t n = trace_head.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot& slot = trace_ring[n % DDB_IPC_TRACE_SPANS];
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.detail.store(detail, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    slot.tid.store(trace_tid(), std::memory_order_relaxed);
+    slot.request.store(id ? id.value() : INT64_MIN, std::memory_order_relaxed);
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+}
+
+void set_trace_request(request_id id) { traced_request = id; }
+
+request_id trace_request() { return traced_request; }
+
+// when the calling thread took pl_lock, which is recursive, and how many
+// times it holds it
+thread_local std::chrono::steady_clock::time_point pl_lock_taken;
+thread_local int pl_lock_depth = 0;
+
+void pl_lock_traced() {
+    if (!tracing()) {
+        ddb_api->pl_lock();
+    } else {
+        trace_time_t start = trace_now();
+        ddb_api->pl_lock();
+        trace_span("pl_lock", start, trace_now(), traced_request);
+    }
+    if (pl_lock_depth++ == 0) {
+        pl_lock_taken = std::chrono::steady_clock::now();
+    }
+}
+
+void pl_unlock_traced() {
+    if (--pl_lock_depth == 0) {
+        record_pl_lock_hold(std::chrono::steady_clock::now() - pl_lock_taken);
+    }
+    ddb_api->pl_unlock();
+}
+
+void update_tracing() {
+    bool enable = ddb_api->conf_get_int(DDB_IPC_PROJECT_ID ".trace", 0);
+    if (trace_enabled.exchange(enable) != enable) {
+        get_logger()->info("Tracing {}.", enable ? "enabled" : "disabled");
+    }
+}
+
+class DumpTraceArgument : Argument {
+  public:
+    bool clear = false;
+};
+DDB_IPC_DEFINE_TYPE_WITH_DEFAULT(DumpTraceArgument, clear);
+COMMAND(dump_trace, DumpTraceArgument) {
+    json events = json::array();
+    int pid = getpid();
+    uint64_t head = trace_head.load(std::memory_order_acquire);
+    uint64_t n = head > DDB_IPC_TRACE_SPANS ? head - DDB_IPC_TRACE_SPANS : 0;
+    n = std::max(n, trace_floor.load());
+    for (; n < head; n++) {
+        TraceSlot& slot = trace_ring[n % DDB_IPC_TRACE_SPANS];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * n + 2) {
+            // still being written, or already overwritten
+            continue;
+        }
+        const char* name = slot.name.load(std::memory_order_relaxed);
+        const char* detail = slot.detail.load(std::memory_order_relaxed);
+        trace_time_t start = slot.start.load(std::memory_order_relaxed);
+        trace_time_t end = slot.end.load(std::memory_order_relaxed);
+        int tid = slot.tid.load(std::memory_order_relaxed);
+        int64_t request = slot.request.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) {
+            continue;
+        }
+        json span_args = json::object();
+        if (request != INT64_MIN) {
+            span_args["request_id"] = request;
+        }
+        if (detail) {
+            span_args["detail"] = detail;
+        }
+        // complete events, timestamps in microseconds
+        events.push_back({
+            {"name", name},
+            {"cat", DDB_IPC_PROJECT_ID},
+            {"ph", "X"},
+            {"ts", start / 1000.0},
+            {"dur", (end - start) / 1000.0},
+            {"pid", pid},
+            {"tid", tid},
+            {"args", span_args},
+        });
+    }
+    if (args.clear) {
+        trace_floor = head;
+    }
+    // the response itself can be loaded as a trace
+    json resp = ok_response(id);
+    resp["traceEvents"] = events;
+    resp["displayTimeUnit"] = "ms";
+    return resp;
+}
+
+}  // namespace ddb_ipc
@@ -0,0 +1,390 @@
+#include "visualization.hpp"
+
+#include <deadbeef/deadbeef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "ddb_ipc.hpp"
+#include "response.hpp"
+
+namespace ddb_ipc {
+
+typedef std::chrono::steady_clock vis_clock;
+
+enum VisType {
+    DDB_IPC_VIS_WAVEFORM,
+    DDB_IPC_VIS_SPECTRUM,
+};
+const char* vis_type_names[] = {"waveform", "spectrum"};
+
+// The latest data of one type, written by the audio thread and read by the
+// IPC thread without either of them waiting: seq is odd while the writer is
+// busy, and a reader that sees it change retries.
+template <size_t N>
+struct VisSlot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<int> channels{0};
+    // values per channel
+    std::atomic<int> size{0};
+    std::atomic<float> values[N];
+};
+
+struct VisSnapshot {
+    uint64_t seq;
+    int channels;
+    int size;
+    std::vector<float> values;
+};
+
+// peak and RMS per channel
+VisSlot<2 * DDB_IPC_VIS_MAX_CHANNELS> waveform_slot;
+// magnitude per channel and frequency bin
+VisSlot<DDB_IPC_VIS_MAX_CHANNELS * DDB_IPC_VIS_MAX_BINS> spectrum_slot;
+
+// Set by the reader to have the writer start a new window for peak and RMS,
+// so that frames cover all the audio since the previous one
+std::atomic<bool> waveform_reset = true;
+
+// f(channel, i) gives the value to publish
+template <size_t N, typename F>
+void publish(VisSlot<N>& slot, int channels, int size, F f) {
+    uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.channels.store(channels, std::memory_order_relaxed);
+    slot.size.store(size, std::memory_order_relaxed);
+    for (int c = 0; c < channels; c++) {
+        for (int i = 0; i < size; i++) {
+            slot.values[c * size + i].store(f(c, i), std::memory_order_relaxed);
+        }
+    }
+    slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+template <size_t N>
+std::optional<VisSnapshot> read_slot(VisSlot<N>& slot) {
+    VisSnapshot snap;
+    for (int attempt = 0; attempt < 3; attempt++) {
+        snap.seq = slot.seq.load(std::memory_order_acquire);
+        if (snap.seq % 2) {
+            continue;
+        }
+        snap.channels = slot.channels.load(std::memory_order_relaxed);
+        snap.size = slot.size.load(std::memory_order_relaxed);
+        snap.values.resize(snap.channels * snap.size);
+        for (size_t i = 0; i < snap.values.size(); i++) {
+            snap.values[i] = slot.values[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == snap.seq) {
+            return snap;
+        }
+    }
+    return std::nullopt;
+}
+
+// Accumulated by the audio thread only
+float waveform_peak[DDB_IPC_VIS_MAX_CHANNELS];
+double waveform_sumsq[DDB_IPC_VIS_MAX_CHANNELS];
+int64_t waveform_frames;
+
+void waveform_callback(void* ctx, ddb_audio_data_t* data) {
+    int stride = data->fmt->channels;
+    int channels = std::min(stride, DDB_IPC_VIS_MAX_CHANNELS);
+    if (waveform_reset.exchange(false, std::memory_order_acquire)) {
+        std::fill_n(waveform_peak, DDB_IPC_VIS_MAX_CHANNELS, 0);
+        std::fill_n(waveform_sumsq, DDB_IPC_VIS_MAX_CHANNELS, 0);
+        waveform_frames = 0;
+    }
+    for (int f = 0; f < data->nframes; f++) {
+        for (int c = 0; c < channels; c++) {
+            float x = data->data[f * stride + c];
+            waveform_peak[c] = std::max(waveform_peak[c], std::fabs(x));
+            waveform_sumsq[c] += x * x;
+        }
+    }
+    waveform_frames += data->nframes;
+    if (waveform_frames == 0) {
+        return;
+    }
+    publish(waveform_slot, channels, 2, [](int c, int i) {
+        return i == 0 ? waveform_peak[c]
+                      : (float)std::sqrt(waveform_sumsq[c] / waveform_frames);
+    });
+}
+
+void spectrum_callback(void* ctx, ddb_audio_data_t* data) {
+    // channels are stored one after the other, nframes bins each
+    int bins = std::min(data->nframes, DDB_IPC_VIS_MAX_BINS);
+    int channels = std::min(data->fmt->channels, DDB_IPC_VIS_MAX_CHANNELS);
+    publish(spectrum_slot, channels, bins, [data](int c, int i) {
+        return data->data[c * data->nframes + i];
+    });
+}
+
+struct VisSubscription {
+    int socket;
+    VisType type;
+    int bands;
+    vis_clock::duration interval;
+    vis_clock::time_point next_frame;
+    // seq of the data in the last frame sent, to skip frames while silent
+    uint64_t last_seq;
+};
+// only accessed on the IPC thread
+std::vector<VisSubscription> vis_subscriptions;
+bool vis_listening[2] = {false, false};
+
+// Listen for the types of data that someone is subscribed to, and only those
+void update_listeners() {
+    bool wanted[2] = {false, false};
+    for (auto& s : vis_subscriptions) {
+        wanted[s.type] = true;
+    }
+    if (wanted[DDB_IPC_VIS_WAVEFORM] != vis_listening[DDB_IPC_VIS_WAVEFORM]) {
+        if (wanted[DDB_IPC_VIS_WAVEFORM]) {
+            ddb_api->vis_waveform_listen(&waveform_slot, waveform_callback);
+        } else {
+            ddb_api->vis_waveform_unlisten(&waveform_slot);
+        }
+    }
+    if (wanted[DDB_IPC_VIS_SPECTRUM] != vis_listening[DDB_IPC_VIS_SPECTRUM]) {
+        if (wanted[DDB_IPC_VIS_SPECTRUM]) {
+            ddb_api->vis_spectrum_listen(&spectrum_slot, spectrum_callback);
+        } else {
+            ddb_api->vis_spectrum_unlisten(&spectrum_slot);
+        }
+    }
+    vis_listening[DDB_IPC_VIS_WAVEFORM] = wanted[DDB_IPC_VIS_WAVEFORM];
+    vis_listening[DDB_IPC_VIS_SPECTRUM] = wanted[DDB_IPC_VIS_SPECTRUM];
+}
+
+// Levels are sent as integers in per mille of full scale
+int vis_level(float x) {
+    return std::lround(std::clamp(x, 0.0f, 1.0f) * 1000);
+}
+
+// Spectrum magnitudes are shown on a decibel scale spanning
+// DDB_IPC_VIS_SPECTRUM_RANGE_DB below full scale
+int vis_level_db(float magnitude) {
+    if (magnitude <= 0) {
+        return 0;
+    }
+    float db = 20 * std::log10(magnitude);
+    return vis_level(1 + db / DDB_IPC_VIS_SPECTRUM_RANGE_DB);
+}
+
+json waveform_frame(const VisSnapshot& snap) {
+    json peak = json::array(), rms = json::array();
+    for (int c = 0; c < snap.channels; c++) {
+        peak.push_back(vis_level(snap.values[2 * c]));
+        rms.push_back(vis_level(snap.values[2 * c + 1]));
+    }
+    return json{
+        {"event", "visualization"},
+        {"type", "waveform"},
+        {"peak", peak},
+        {"rms", rms},
+    };
+}
+
+// Reduce the bins of each channel to bands logarithmically spaced in
+// frequency, taking the largest magnitude in each
+json spectrum_frame(const VisSnapshot& snap, int n_bands) {
+    json bands = json::array();
+    for (int c = 0; c < snap.channels; c++) {
+        const float* bins = snap.values.data() + c * snap.size;
+        json channel = json::array();
+        // bin 0 is the DC offset
+        int lo = 1;
+        for (int b = 0; b < n_bands; b++) {
+            int hi = std::lround(std::pow(snap.size, (b + 1.0) / n_bands));
+            hi = std::min(std::max(hi, lo + 1), snap.size);
+            float m = 0;
+            for (int i = lo; i < hi; i++) {
+                m = std::max(m, bins[i]);
+            }
+            channel.push_back(vis_level_db(m));
+            lo = std::max(lo, hi);
+        }
+        bands.push_back(channel);
+    }
+    return json{
+        {"event", "visualization"},
+        {"type", "spectrum"},
+        {"bands", bands},
+    };
+}
+
+int next_frame_ms() {
+    if (vis_subscriptions.empty()) {
+        return -1;
+    }
+    auto earliest = vis_subscriptions[0].next_frame;
+    for (auto& s : vis_subscriptions) {
+        earliest = std::min(earliest, s.next_frame);
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        earliest - vis_clock::now()
+    );
+    return std::max((int)ms.count(), 0);
+}
+
+void send_visualization_frames() {
+    if (vis_subscriptions.empty()) {
+        return;
+    }
+    auto now = vis_clock::now();
+    std::optional<VisSnapshot> snaps[2];
+    bool read[2] = {false, false};
+    // sending may close connections, and with them subscriptions, so the
+    // frames are collected first
+    std::vector<std::pair<int, json>> frames;
+    for (auto& s : vis_subscriptions) {
+        if (now < s.next_frame) {
+            continue;
+        }
+        s.next_frame += s.interval;
+        if (s.next_frame < now) {
+            // we fell behind, do not try to catch up
+            s.next_frame = now + s.interval;
+        }
+        if (output_pending(s.socket)) {
+            // the client is behind; the frame is dropped rather than queued
+            // after what it has yet to read
+            continue;
+        }
+        if (!read[s.type]) {
+            if (s.type == DDB_IPC_VIS_WAVEFORM) {
+                snaps[s.type] = read_slot(waveform_slot);
+                waveform_reset = true;
+            } else {
+                snaps[s.type] = read_slot(spectrum_slot);
+            }
+            read[s.type] = true;
+        }
+        auto& snap = snaps[s.type];
+        if (!snap || snap->seq == s.last_seq || snap->channels == 0) {
+            continue;
+        }
+        s.last_seq = snap->seq;
+        frames.emplace_back(
+            s.socket,
+            s.type == DDB_IPC_VIS_WAVEFORM ? waveform_frame(*snap)
+                                           : spectrum_frame(*snap, s.bands)
+        );
+    }
+    for (auto& [socket, frame] : frames) {
+        send_response(frame, socket);
+    }
+}
+
+void drop_visualization_subscriptions(int socket) {
+    auto it = std::remove_if(
+        vis_subscriptions.begin(),
+        vis_subscriptions.end(),
+        [socket](const VisSubscription& s) { return s.socket == socket; }
+    );
+    if (it != vis_subscriptions.end()) {
+        vis_subscriptions.erase(it, vis_subscriptions.end());
+        update_listeners();
+    }
+}
+
+std::optional<VisType> parse_vis_type(const std::string& name) {
+    for (int t = 0; t < 2; t++) {
+        if (name == vis_type_names[t]) {
+            return (VisType)t;
+        }
+    }
+    return std::nullopt;
+}
+
+class SubscribeVisualizationArgument : Argument {
+  public:
+    std::string type;
+    int fps = DDB_IPC_VIS_DEFAULT_FPS;
+    int bands = DDB_IPC_VIS_DEFAULT_BANDS;
+    int socket;
+};
+DDB_IPC_DEFINE_TYPE_WITH_DEFAULT(
+    SubscribeVisualizationArgument, type, fps, bands, socket
+);
+COMMAND(subscribe_visualization, SubscribeVisualizationArgument) {
+    std::optional<VisType> type = parse_vis_type(args.type);
+    if (!type) {
+        return bad_request_response(
+            id, "Argument type must be one of waveform and spectrum."
+        );
+    }
+    if (args.fps < 1 || args.fps > DDB_IPC_VIS_MAX_FPS) {
+        return bad_request_response(
+            id,
+            "Argument fps must be from [1, " +
+                std::to_string(DDB_IPC_VIS_MAX_FPS) + "]."
+        );
+    }
+    if (args.bands < 1 || args.bands > DDB_IPC_VIS_MAX_BANDS) {
+        return bad_request_response(
+            id,
+            "Argument bands must be from [1, " +
+                std::to_string(DDB_IPC_VIS_MAX_BANDS) + "]."
+        );
+    }
+    auto interval = std::chrono::duration_cast<vis_clock::duration>(
+        std::chrono::duration<double>(1.0 / args.fps)
+    );
+    VisSubscription sub{
+        .socket = args.socket,
+        .type = type.value(),
+        .bands = args.bands,
+        .interval = interval,
+        .next_frame = vis_clock::now() + interval,
+        .last_seq = 0,
+    };
+    // subscribing again changes the rate and number of bands
+    for (auto& s : vis_subscriptions) {
+        if (s.socket == sub.socket && s.type == sub.type) {
+            s = sub;
+            return ok_response(id);
+        }
+    }
+    vis_subscriptions.push_back(sub);
+    update_listeners();
+    return ok_response(id);
+}
+
+class UnsubscribeVisualizationArgument : Argument {
+  public:
+    std::string type;
+    int socket;
+};
+DDB_IPC_DEFINE_TYPE(
+    UnsubscribeVisualizationArgument, type, socket
+);
+COMMAND(unsubscribe_visualization, UnsubscribeVisualizationArgument) {
+    std::optional<VisType> type = parse_vis_type(args.type);
+    auto it = std::find_if(
+        vis_subscriptions.begin(),
+        vis_subscriptions.end(),
+        [&](const VisSubscription& s) {
+            return s.socket == args.socket && type && s.type == type.value();
+        }
+    );
+    if (it == vis_subscriptions.end()) {
+        return error_response(
+            id, "Not subscribed to visualization " + args.type + "."
+        );
+    }
+    vis_subscriptions.erase(it);
+    update_listeners();
+    return ok_response(id);
+}
+
+}  // namespace ddb_ipc
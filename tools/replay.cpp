@@ -0,0 +1,404 @@
+// ddb_ipc_replay: play a capture recorded by ddb_ipc back against a running
+// instance and compare the responses with the recorded ones.
+//
+// usage: ddb_ipc_replay [-s speed] [-S socket] [-w ms] [-i key]... capture
+//
+// Requests are sent with the recorded timing divided by speed; a speed of 0
+// sends them as fast as possible. Responses are matched to recorded ones by
+// request id within each connection and compared as JSON, without the
+// top-level keys given with -i. Events are only counted, since their timing
+// relative to requests is not reproducible. The exit status is 0 if every
+// response matched.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+typedef std::chrono::steady_clock steady_clock;
+
+#define DEFAULT_SOCKET "/tmp/ddb_socket"
+#define DEFAULT_WAIT_MS 2000
+
+struct Record {
+    int64_t us;
+    unsigned conn;
+    char kind;
+    std::string message;
+};
+
+struct Connection {
+    int fd = -1;
+    bool closing = false;
+    std::string input;
+    // recorded responses and send times of outstanding requests, keyed by
+    // the serialized request id ("null" when there is none)
+    std::map<std::string, std::deque<json>> expected;
+    std::map<std::string, std::deque<steady_clock::time_point>> sent;
+    size_t outstanding = 0;
+    size_t events_expected = 0;
+    size_t events_received = 0;
+};
+
+struct Stats {
+    size_t requests = 0;
+    size_t matched = 0;
+    size_t differed = 0;
+    size_t unexpected = 0;
+    std::vector<double> latencies_ms;
+};
+
+std::set<std::string> ignored_keys;
+
+std::string id_key(const json& message) {
+    auto id = message.find("request_id");
+    return id == message.end() ? "null" : id->dump();
+}
+
+json comparable(json message) {
+    if (message.is_object()) {
+        for (auto& key : ignored_keys) {
+            message.erase(key);
+        }
+    }
+    return message;
+}
+
+bool read_capture(const char* path, std::vector<Record>& records) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Failed to open " << path << "\n";
+        return false;
+    }
+    std::string line;
+    int n = 0;
+    while (std::getline(in, line)) {
+        n++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        Record r;
+        std::istringstream fields(line);
+        fields >> r.us >> r.conn >> r.kind;
+        if (!fields ||
+            (r.kind != '+' && r.kind != '-' && r.kind != '<' && r.kind != '>'))
+        {
+            std::cerr << path << ":" << n << ": malformed record\n";
+            return false;
+        }
+        // the message is everything after the single space following kind
+        std::streamoff pos = fields.tellg();
+        if (pos >= 0 && (size_t)pos + 1 < line.size()) {
+            r.message = line.substr(pos + 1);
+        }
+        records.push_back(std::move(r));
+    }
+    return true;
+}
+
+int connect_to(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    socklen_t len = sizeof(addr);
+    if (path[0] == '@') {
+        // abstract namespace, the name is not NUL terminated
+        addr.sun_path[0] = '\0';
+        len = offsetof(struct sockaddr_un, sun_path) + path.size();
+    }
+    if (::connect(fd, (struct sockaddr*)&addr, len) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool send_line(int fd, const std::string& message) {
+    std::string line = message + "\n";
+    size_t i = 0;
+    while (i < line.size()) {
+        ssize_t sent =
+            send(fd, line.data() + i, line.size() - i, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd = {fd, POLLOUT, 0};
+                poll(&pfd, 1, 1000);
+                continue;
+            }
+            return false;
+        }
+        i += sent;
+    }
+    return true;
+}
+
+void handle_response(
+    unsigned n, Connection& c, const std::string& line, Stats& stats
+) {
+    json message;
+    try {
+        message = json::parse(line);
+    } catch (json::exception& e) {
+        std::cout << "connection " << n << ": invalid JSON: " << line << "\n";
+        stats.unexpected++;
+        return;
+    }
+    if (message.contains("event")) {
+        c.events_received++;
+        return;
+    }
+    std::string key = id_key(message);
+    auto& expected = c.expected[key];
+    if (expected.empty()) {
+        std::cout << "connection " << n << ", request " << key
+                  << ": unexpected response " << line << "\n";
+        stats.unexpected++;
+        return;
+    }
+    auto& sent = c.sent[key];
+    if (!sent.empty()) {
+        std::chrono::duration<double, std::milli> latency =
+            steady_clock::now() - sent.front();
+        stats.latencies_ms.push_back(latency.count());
+        sent.pop_front();
+    }
+    if (comparable(message) == comparable(expected.front())) {
+        stats.matched++;
+    } else {
+        std::cout << "connection " << n << ", request " << key
+                  << ":\n  expected " << expected.front().dump()
+                  << "\n  received " << message.dump() << "\n";
+        stats.differed++;
+    }
+    expected.pop_front();
+    c.outstanding--;
+}
+
+void read_responses(unsigned n, Connection& c, Stats& stats) {
+    char buf[4096];
+    ssize_t rc;
+    while ((rc = recv(c.fd, buf, sizeof(buf), 0)) > 0) {
+        c.input.append(buf, rc);
+    }
+    size_t start = 0, end;
+    while ((end = c.input.find('\n', start)) != std::string::npos) {
+        handle_response(n, c, c.input.substr(start, end - start), stats);
+        start = end + 1;
+    }
+    c.input.erase(0, start);
+    if (rc == 0) {
+        close(c.fd);
+        c.fd = -1;
+    }
+}
+
+void close_if_done(Connection& c) {
+    if (c.closing && c.outstanding == 0 && c.fd > -1) {
+        close(c.fd);
+        c.fd = -1;
+    }
+}
+
+int main(int argc, char** argv) {
+    double speed = 1;
+    std::string socket_path = DEFAULT_SOCKET;
+    int wait_ms = DEFAULT_WAIT_MS;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:S:w:i:")) != -1) {
+        switch (opt) {
+            case 's':
+                speed = atof(optarg);
+                break;
+            case 'S':
+                socket_path = optarg;
+                break;
+            case 'w':
+                wait_ms = atoi(optarg);
+                break;
+            case 'i':
+                ignored_keys.insert(optarg);
+                break;
+            default:
+                std::cerr << "usage: " << argv[0]
+                          << " [-s speed] [-S socket] [-w ms] [-i key]... "
+                             "capture\n";
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        std::cerr << "usage: " << argv[0]
+                  << " [-s speed] [-S socket] [-w ms] [-i key]... capture\n";
+        return 2;
+    }
+    std::vector<Record> records;
+    if (!read_capture(argv[optind], records)) {
+        return 2;
+    }
+
+    // the recorded responses are what we compare against; everything else
+    // is replayed
+    std::map<unsigned, Connection> conns;
+    std::vector<Record> replayed;
+    for (auto& r : records) {
+        Connection& c = conns[r.conn];
+        if (r.kind != '>') {
+            replayed.push_back(std::move(r));
+            continue;
+        }
+        try {
+            json message = json::parse(r.message);
+            if (message.contains("event")) {
+                c.events_expected++;
+            } else {
+                c.expected[id_key(message)].push_back(message);
+                c.outstanding++;
+            }
+        } catch (json::exception& e) {
+            std::cerr << "Skipping recorded response that is not JSON: "
+                      << r.message << "\n";
+        }
+    }
+
+    Stats stats;
+    auto start = steady_clock::now();
+    auto due = [&](const Record& r) {
+        if (speed <= 0) {
+            return start;
+        }
+        return start + std::chrono::duration_cast<steady_clock::duration>(
+                           std::chrono::microseconds(r.us) / speed
+                       );
+    };
+    size_t next = 0;
+    std::optional<steady_clock::time_point> drain_deadline;
+    while (true) {
+        auto now = steady_clock::now();
+        while (next < replayed.size() && due(replayed[next]) <= now) {
+            Record& r = replayed[next++];
+            Connection& c = conns[r.conn];
+            switch (r.kind) {
+                case '+':
+                    c.fd = connect_to(socket_path);
+                    if (c.fd < 0) {
+                        std::cerr << "Failed to connect to " << socket_path
+                                  << ": " << strerror(errno) << "\n";
+                        return 2;
+                    }
+                    break;
+                case '<':
+                    if (c.fd < 0 || !send_line(c.fd, r.message)) {
+                        std::cout << "connection " << r.conn
+                                  << ": failed to send " << r.message << "\n";
+                        break;
+                    }
+                    stats.requests++;
+                    try {
+                        c.sent[id_key(json::parse(r.message))].push_back(
+                            steady_clock::now()
+                        );
+                    } catch (json::exception& e) {
+                        // the recorded error response is still expected
+                    }
+                    break;
+                case '-':
+                    // responses may still be on their way
+                    c.closing = true;
+                    close_if_done(c);
+                    break;
+            }
+        }
+        bool outstanding = false;
+        std::vector<pollfd> pfds;
+        std::vector<unsigned> polled;
+        for (auto& [n, c] : conns) {
+            if (c.fd > -1) {
+                pfds.push_back({c.fd, POLLIN, 0});
+                polled.push_back(n);
+            }
+            outstanding = outstanding || (c.outstanding > 0 && c.fd > -1);
+        }
+        if (next == replayed.size()) {
+            if (!outstanding) {
+                break;
+            }
+            if (!drain_deadline) {
+                drain_deadline = now + std::chrono::milliseconds(wait_ms);
+            }
+        }
+        auto until = next < replayed.size() ? due(replayed[next])
+                                            : drain_deadline.value();
+        if (until <= now && next == replayed.size()) {
+            break;
+        }
+        int timeout =
+            std::chrono::duration_cast<std::chrono::milliseconds>(until - now)
+                .count();
+        if (poll(pfds.data(), pfds.size(), std::max(timeout, 0)) < 0 &&
+            errno != EINTR)
+        {
+            perror("poll");
+            return 2;
+        }
+        for (size_t i = 0; i < pfds.size(); i++) {
+            if (pfds[i].revents) {
+                Connection& c = conns[polled[i]];
+                read_responses(polled[i], c, stats);
+                close_if_done(c);
+            }
+        }
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+        steady_clock::now() - start;
+
+    size_t missing = 0, events_expected = 0, events_received = 0;
+    for (auto& [n, c] : conns) {
+        for (auto& [key, responses] : c.expected) {
+            for (auto& r : responses) {
+                std::cout << "connection " << n << ", request " << key
+                          << ": no response, expected " << r.dump() << "\n";
+                missing++;
+            }
+        }
+        events_expected += c.events_expected;
+        events_received += c.events_received;
+        if (c.fd > -1) {
+            close(c.fd);
+        }
+    }
+    std::cout << stats.requests << " requests in " << elapsed.count()
+              << " ms: " << stats.matched << " matched, " << stats.differed
+              << " differed, " << missing << " missing, " << stats.unexpected
+              << " unexpected; " << events_received << " events received, "
+              << events_expected << " recorded\n";
+    auto& l = stats.latencies_ms;
+    if (!l.empty()) {
+        std::sort(l.begin(), l.end());
+        std::cout << "latency: p50 " << l[l.size() / 2] << " ms, p99 "
+                  << l[std::min(l.size() - 1, l.size() * 99 / 100)]
+                  << " ms, max " << l.back() << " ms\n";
+    }
+    return stats.differed || missing || stats.unexpected ? 1 : 0;
+}